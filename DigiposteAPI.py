@@ -8,6 +8,8 @@ import webview
 import threading
 import time
 
+STREAM_CHUNK_SIZE = 256 * 1024
+
 class AuthAPI:
     def __init__(self):
         self.token = None
@@ -105,7 +107,7 @@ class DigiposteAPI():
     
     def get_file(self, file_id, dest_path):
         try:
-            resp = self._session.get("https://api.digiposte.fr/api/v3/document/{}/content".format(file_id), allow_redirects=False)
+            resp = self._session.get("https://api.digiposte.fr/api/v3/document/{}/content".format(file_id), allow_redirects=False, stream=True)
         except requests.Timeout:
             return "err"
         except (requests.RequestException, requests.ConnectionError, requests.TooManyRedirects) as e:
@@ -114,15 +116,94 @@ class DigiposteAPI():
         
         if resp.status_code != 200:
             print("get_file() HTTP error code:", resp.status_code)
+            resp.close()
+            return "err"
+        
+        try:
+            with open(dest_path, 'wb') as f:
+                for chunk in resp.iter_content(chunk_size=STREAM_CHUNK_SIZE):
+                    f.write(chunk)
+        except Exception as e:
+            print(e)
+            return "err"
+        finally:
+            resp.close()
+        
+        return "OK"
+    
+    def get_file_if(self, file_id, dest_path, etag):
+        headers = {"If-None-Match": etag} if etag else {}
+        
+        try:
+            resp = self._session.get("https://api.digiposte.fr/api/v3/document/{}/content".format(file_id), headers=headers, allow_redirects=False, stream=True)
+        except requests.Timeout:
+            return "err"
+        except (requests.RequestException, requests.ConnectionError, requests.TooManyRedirects) as e:
+            print(e)
+            return "err"
+        
+        # The copy at dest_path is still the current content of the document
+        if resp.status_code == 304:
+            resp.close()
+            return "same"
+        
+        if resp.status_code != 200:
+            print("get_file_if() HTTP error code:", resp.status_code)
+            resp.close()
             return "err"
         
         try:
             with open(dest_path, 'wb') as f:
-                f.write(resp.content)
+                for chunk in resp.iter_content(chunk_size=STREAM_CHUNK_SIZE):
+                    f.write(chunk)
+        except Exception as e:
+            print(e)
+            return "err"
+        finally:
+            resp.close()
+        
+        # The daemon keeps etags up to 127 bytes, a longer one is not worth matching later
+        etag = resp.headers.get("ETag", "")
+        if len(etag.encode()) >= 128:
+            etag = ""
+        return "OK " + etag
+    
+    def get_file_range(self, file_id, dest_path, offset, length):
+        headers = {"Range": "bytes={}-{}".format(offset, offset + length - 1)}
+        
+        try:
+            resp = self._session.get("https://api.digiposte.fr/api/v3/document/{}/content".format(file_id), headers=headers, allow_redirects=False, stream=True)
+        except requests.Timeout:
+            return "err"
+        except (requests.RequestException, requests.ConnectionError, requests.TooManyRedirects) as e:
+            print(e)
+            return "err"
+        
+        if resp.status_code not in (200, 206):
+            print("get_file_range() HTTP error code:", resp.status_code)
+            resp.close()
+            return "err"
+        
+        # Without range support the whole document is sent, it is written from the start
+        if resp.status_code == 200:
+            offset = 0
+        
+        try:
+            fd = os.open(dest_path, os.O_WRONLY | os.O_CREAT, 0o600)
+            try:
+                for chunk in resp.iter_content(chunk_size=STREAM_CHUNK_SIZE):
+                    os.pwrite(fd, chunk, offset)
+                    offset += len(chunk)
+            finally:
+                os.close(fd)
         except Exception as e:
             print(e)
             return "err"
+        finally:
+            resp.close()
         
+        if resp.status_code == 200:
+            return "all"
         return "OK"
     
     def create_folder(self, name, parent_id):
@@ -254,6 +335,12 @@ if __name__ == "__main__":
     parser_get_file.add_argument("file_id", help="File ID to download")
     parser_get_file.add_argument("dest_path", help="Destination path for the downloaded file")
     
+    parser_get_file_range = subparsers.add_parser('get_file_range', help='Get a byte range of a file')
+    parser_get_file_range.add_argument("file_id", help="File ID to download")
+    parser_get_file_range.add_argument("dest_path", help="Destination path for the downloaded range")
+    parser_get_file_range.add_argument("offset", type=int, help="Offset of the range in bytes")
+    parser_get_file_range.add_argument("length", type=int, help="Length of the range in bytes")
+    
     parser_create_folder = subparsers.add_parser('create_folder', help='Create folder')
     parser_create_folder.add_argument("name", help="Name of the new folder")
     parser_create_folder.add_argument("parent_id", help="Folder ID of the parent folder")
@@ -305,6 +392,14 @@ if __name__ == "__main__":
                 else:
                     os.write(write_fd, b'OK' + b'\0')
             
+            elif com[0] == b"get_file_if":
+                r = dgp_api.get_file_if(com[1].decode(), com[2].decode(), com[3].decode())
+                os.write(write_fd, r.encode() + b'\0')
+            
+            elif com[0] == b"get_file_range":
+                r = dgp_api.get_file_range(com[1].decode(), com[2].decode(), int(com[3]), int(com[4]))
+                os.write(write_fd, r.encode() + b'\0')
+            
             elif com[0] == b"create_folder":
                 folder_id = dgp_api.create_folder(com[1].decode(), com[2].decode())
                 os.write(write_fd, folder_id.encode() + b'\0')
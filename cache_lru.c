@@ -0,0 +1,122 @@
+#include "cache_lru.h"
+
+static void cache_lru_unlink(cache_lru *lru, c_file *file)
+{
+    if (file->lru_prev != NULL) file->lru_prev->lru_next = file->lru_next;
+    else lru->head = file->lru_next;
+    if (file->lru_next != NULL) file->lru_next->lru_prev = file->lru_prev;
+    else lru->tail = file->lru_prev;
+
+    file->lru_prev = NULL;
+    file->lru_next = NULL;
+    file->in_lru = 0;
+    lru->bytes -= file->charged;
+    lru->files--;
+    file->charged = 0;
+}
+
+static char cache_lru_over(const cache_lru *lru)
+{
+    return (lru->max_bytes != 0 && lru->bytes + lru->idle_bytes > lru->max_bytes) ||
+        (lru->max_files != 0 && lru->files + lru->idle_files > lru->max_files);
+}
+
+void cache_lru_init(cache_lru *lru)
+{
+    memset(lru, 0, sizeof(cache_lru));
+    pthread_mutex_init(&lru->lock, NULL);
+}
+
+void cache_lru_touch(cache_lru *lru, c_file *file)
+{
+    pthread_mutex_lock(&lru->lock);
+    if (file->in_lru) cache_lru_unlink(lru, file);
+
+    file->lru_next = lru->head;
+    if (lru->head != NULL) lru->head->lru_prev = file;
+    else lru->tail = file;
+    lru->head = file;
+    file->in_lru = 1;
+    file->charged = file->size;
+    lru->bytes += file->charged;
+    lru->files++;
+    pthread_mutex_unlock(&lru->lock);
+}
+
+void cache_lru_remove(cache_lru *lru, c_file *file)
+{
+    pthread_mutex_lock(&lru->lock);
+    if (file->in_lru) cache_lru_unlink(lru, file);
+    pthread_mutex_unlock(&lru->lock);
+}
+
+void cache_lru_set_idle(cache_lru *lru, const uint64_t bytes, const int files)
+{
+    pthread_mutex_lock(&lru->lock);
+    lru->idle_bytes = bytes;
+    lru->idle_files = files;
+    pthread_mutex_unlock(&lru->lock);
+}
+
+char cache_lru_over_bounds(cache_lru *lru)
+{
+    char over;
+
+    pthread_mutex_lock(&lru->lock);
+    over = cache_lru_over(lru);
+    pthread_mutex_unlock(&lru->lock);
+
+    return over;
+}
+
+c_file* cache_lru_victim(cache_lru *lru, const c_file *keep)
+{
+    c_file *file;
+
+    pthread_mutex_lock(&lru->lock);
+    if (!cache_lru_over(lru)) {
+        pthread_mutex_unlock(&lru->lock);
+        return NULL;
+    }
+
+    //The lock of a file is taken before the one of the list elsewhere, so it is only tried here
+    for (file=lru->tail; file!=NULL; file=file->lru_prev) {
+        if (file == keep || pthread_mutex_trylock(&file->lock) != 0) continue;
+        if (file->opens == 0 && !file->dirty && !file->streaming) {
+            cache_lru_unlink(lru, file);
+            pthread_mutex_unlock(&lru->lock);
+            return file;
+        }
+        pthread_mutex_unlock(&file->lock);
+    }
+    pthread_mutex_unlock(&lru->lock);
+
+    return NULL;
+}
+
+void cache_lru_clear(cache_lru *lru)
+{
+    c_file *file, *next;
+
+    pthread_mutex_lock(&lru->lock);
+    for (file=lru->head; file!=NULL; file=next) {
+        next = file->lru_next;
+        file->lru_prev = NULL;
+        file->lru_next = NULL;
+        file->in_lru = 0;
+        file->charged = 0;
+    }
+    lru->head = NULL;
+    lru->tail = NULL;
+    lru->bytes = 0;
+    lru->files = 0;
+    lru->idle_bytes = 0;
+    lru->idle_files = 0;
+    pthread_mutex_unlock(&lru->lock);
+}
+
+void cache_lru_free(cache_lru *lru)
+{
+    cache_lru_clear(lru);
+    pthread_mutex_destroy(&lru->lock);
+}
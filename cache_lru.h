@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "data_structures.h"
+
+#ifndef DGP_CACHE_LRU_H
+#define DGP_CACHE_LRU_H
+
+/*
+Files holding a cached copy, from the most recently used at head to the least at tail
+Each file is charged its size when used, bytes and files add up the charges of the list
+idle_bytes and idle_files charge the copies kept on the disk without a file in the list, older than any of them
+max_bytes and max_files bound both charges together, 0 means no bound
+The list links of the files are guarded by the lock of the list, which may be taken with the lock of a file held
+*/
+typedef struct cache_lru {
+    pthread_mutex_t lock;
+    c_file *head;
+    c_file *tail;
+    uint64_t bytes;
+    int files;
+    uint64_t idle_bytes;
+    int idle_files;
+    uint64_t max_bytes;
+    int max_files;
+} cache_lru;
+
+/*
+Initialize an empty list without bounds
+*/
+void cache_lru_init(cache_lru *lru);
+
+/*
+Move file to the head of the list, adding it if needed, and charge it its current size
+*/
+void cache_lru_touch(cache_lru *lru, c_file *file);
+
+/*
+Take file out of the list
+Must be called before the file loses its cached copy by other means than eviction, or is freed
+*/
+void cache_lru_remove(cache_lru *lru, c_file *file);
+
+/*
+Replace the charge of the idle copies
+*/
+void cache_lru_set_idle(cache_lru *lru, const uint64_t bytes, const int files);
+
+/*
+Tell whether the list and the idle copies are over the bounds
+*/
+char cache_lru_over_bounds(cache_lru *lru);
+
+/*
+While the list is over its bounds, take out the least recently used file that can be evicted and return it with its lock held
+A file can be evicted once it has no open handle, nothing to upload and no download in progress
+keep is never returned, files whose lock is busy are skipped
+The tree lock must be held so that the files stay allocated
+Return NULL if the list is within its bounds or no file can be evicted
+*/
+c_file* cache_lru_victim(cache_lru *lru, const c_file *keep);
+
+/*
+Empty the list, before the files are freed
+*/
+void cache_lru_clear(cache_lru *lru);
+
+/*
+Empty the list and release its lock
+*/
+void cache_lru_free(cache_lru *lru);
+
+#endif
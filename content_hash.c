@@ -0,0 +1,100 @@
+#include "content_hash.h"
+
+#define CONTENT_HASH_CHUNK 65536
+
+static uint64_t rotl(const uint64_t x, const int r)
+{
+    return (x << r) | (x >> (64-r));
+}
+
+static uint64_t mix_word(uint64_t h, uint64_t w)
+{
+    w *= 0x87c37b91114253d5ULL;
+    w = rotl(w, 31);
+    w *= 0x4cf5ad432745937fULL;
+    h ^= w;
+    return rotl(h, 27) * 5 + 0x52dce729;
+}
+
+static uint64_t finalize(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+Read up to size bytes, only stopping short at the end of the file
+Return the number of bytes read, -1 on error
+*/
+static ssize_t read_full(const int fd, unsigned char *buf, const size_t size)
+{
+    size_t done = 0;
+    ssize_t r;
+
+    while (done < size) {
+        r = read(fd, buf+done, size-done);
+        if (r == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (r == 0) break;
+        done += r;
+    }
+
+    return done;
+}
+
+int content_hash(const char *path, uint64_t *hash)
+{
+    unsigned char *buf;
+    uint64_t h, w, total;
+    ssize_t n;
+    size_t i;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("open()");
+        return -1;
+    }
+    buf = malloc(CONTENT_HASH_CHUNK);
+    if (buf == NULL) {
+        perror("malloc()");
+        close(fd);
+        return -1;
+    }
+
+    //Chunks are full but the last one, so that words never straddle two of them
+    h = 0x9e3779b97f4a7c15ULL;
+    total = 0;
+    do {
+        n = read_full(fd, buf, CONTENT_HASH_CHUNK);
+        if (n == -1) {
+            perror("read()");
+            free(buf);
+            close(fd);
+            return -1;
+        }
+        for (i=0; i+8<=(size_t)n; i+=8) {
+            memcpy(&w, buf+i, 8);
+            h = mix_word(h, w);
+        }
+        if (i < (size_t)n) {
+            w = 0;
+            memcpy(&w, buf+i, n-i);
+            h = mix_word(h, w);
+        }
+        total += n;
+    } while (n == CONTENT_HASH_CHUNK);
+
+    free(buf);
+    close(fd);
+
+    *hash = finalize(h ^ total);
+
+    return 0;
+}
@@ -0,0 +1,19 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef DGP_CONTENT_HASH_H
+#define DGP_CONTENT_HASH_H
+
+/*
+Set hash to a 64-bit hash of the content of the file at path, its length included
+It tells a copy whose content came back to a former one apart from a changed one, it is not meant to resist forgeries
+Return 0 on success, -1 otherwise
+*/
+int content_hash(const char *path, uint64_t *hash);
+
+#endif
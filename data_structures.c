@@ -1,140 +1,769 @@
 #include "data_structures.h"
 
-c_folder* add_folder(c_folder *parent, const char *id, const char *name)
+#define NAME_INDEX_MIN_CAPACITY 16
+#define POOL_MIN_ITEMS 64
+#define POOL_MAX_ITEMS 4096
+#define NAMES_MIN_CHUNK 4096
+#define NAMES_MAX_CHUNK 262144
+#define TABLE_MIN_CAPACITY 8
+
+static unsigned int hash_name(const char *name)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int name_index_grow(name_index *idx)
 {
-    c_folder *new, **folder_table;
-    int name_len = 0;
+    name_slot *slots;
+    int capacity, mask, i, j;
 
-    new = malloc(sizeof(c_folder));
-    if (new == NULL) {
+    capacity = idx->capacity == 0 ? NAME_INDEX_MIN_CAPACITY : idx->capacity*2;
+    slots = malloc(capacity * sizeof(name_slot));
+    if (slots == NULL) {
         perror("malloc()");
-        return NULL;
+        return -1;
+    }
+    for (i=0; i<capacity; i++) slots[i].index = -1;
+
+    mask = capacity-1;
+    for (i=0; i<idx->capacity; i++) {
+        if (idx->slots[i].index == -1) continue;
+        j = idx->slots[i].hash & mask;
+        while (slots[j].index != -1) j = (j+1) & mask;
+        slots[j] = idx->slots[i];
+    }
+
+    free(idx->slots);
+    idx->slots = slots;
+    idx->capacity = capacity;
+
+    return 0;
+}
+
+static int name_index_insert(name_index *idx, const unsigned int hash, const int index)
+{
+    int mask, i;
+
+    if ((idx->count+1)*2 > idx->capacity && name_index_grow(idx) == -1) return -1;
+
+    mask = idx->capacity-1;
+    i = hash & mask;
+    while (idx->slots[i].index != -1) i = (i+1) & mask;
+    idx->slots[i].hash = hash;
+    idx->slots[i].index = index;
+    idx->count++;
+
+    return 0;
+}
+
+/*
+Remove the slot of hash pointing to index and close the gap with backward shift deletion
+If shift is true, all indexes above the removed one are decremented to follow the table compaction
+*/
+static void name_index_remove(name_index *idx, const unsigned int hash, const int index, const char shift)
+{
+    int mask, i, j, k;
+
+    if (idx->capacity == 0) return;
+
+    mask = idx->capacity-1;
+    i = hash & mask;
+    while (idx->slots[i].index != index || idx->slots[i].hash != hash) {
+        if (idx->slots[i].index == -1) return;
+        i = (i+1) & mask;
+    }
+    idx->slots[i].index = -1;
+    idx->count--;
+
+    j = i;
+    while (1) {
+        j = (j+1) & mask;
+        if (idx->slots[j].index == -1) break;
+        k = idx->slots[j].hash & mask;
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        idx->slots[i] = idx->slots[j];
+        idx->slots[j].index = -1;
+        i = j;
     }
 
+    if (!shift || index == idx->count) return;
+    for (i=0; i<idx->capacity; i++)
+        if (idx->slots[i].index > index) idx->slots[i].index--;
+}
+
+static void name_index_free(name_index *idx)
+{
+    free(idx->slots);
+    idx->slots = NULL;
+    idx->capacity = 0;
+    idx->count = 0;
+}
+
+static unsigned int hash_id(const char *id)
+{
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i=0; i<32; i++) {
+        hash ^= (unsigned char)id[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static const char* id_slot_key(const id_slot *slot)
+{
+    if (slot->is_file) return ((c_file*)slot->node)->id;
+    return ((c_folder*)slot->node)->id;
+}
+
+static int id_index_grow(id_index *idx)
+{
+    id_slot *slots;
+    int capacity, mask, i, j;
+
+    capacity = idx->capacity == 0 ? NAME_INDEX_MIN_CAPACITY : idx->capacity*2;
+    slots = calloc(capacity, sizeof(id_slot));
+    if (slots == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+
+    mask = capacity-1;
+    for (i=0; i<idx->capacity; i++) {
+        if (idx->slots[i].node == NULL) continue;
+        j = idx->slots[i].hash & mask;
+        while (slots[j].node != NULL) j = (j+1) & mask;
+        slots[j] = idx->slots[i];
+    }
+
+    free(idx->slots);
+    idx->slots = slots;
+    idx->capacity = capacity;
+
+    return 0;
+}
+
+static int id_index_insert(id_index *idx, void *node, const char *id, const char is_file)
+{
+    int mask, i;
+
+    if ((idx->count+1)*2 > idx->capacity && id_index_grow(idx) == -1) return -1;
+
+    mask = idx->capacity-1;
+    i = hash_id(id) & mask;
+    while (idx->slots[i].node != NULL) i = (i+1) & mask;
+    idx->slots[i].hash = hash_id(id);
+    idx->slots[i].is_file = is_file;
+    idx->slots[i].node = node;
+    idx->count++;
+
+    return 0;
+}
+
+static void* id_index_lookup(const id_index *idx, const char *id, const char is_file)
+{
+    const id_slot *slot;
+    unsigned int hash;
+    int mask, i;
+
+    if (idx->capacity == 0) return NULL;
+
+    hash = hash_id(id);
+    mask = idx->capacity-1;
+    i = hash & mask;
+    while ((slot = &idx->slots[i])->node != NULL) {
+        if (slot->hash == hash && slot->is_file == is_file && memcmp(id_slot_key(slot), id, 32) == 0)
+            return slot->node;
+        i = (i+1) & mask;
+    }
+
+    return NULL;
+}
+
+/*
+Remove the slot of node, whose id is given, and close the gap with backward shift deletion
+*/
+static void id_index_remove(id_index *idx, const void *node, const char *id)
+{
+    int mask, i, j, k;
+
+    if (idx->capacity == 0) return;
+
+    mask = idx->capacity-1;
+    i = hash_id(id) & mask;
+    while (idx->slots[i].node != node) {
+        if (idx->slots[i].node == NULL) return;
+        i = (i+1) & mask;
+    }
+    idx->slots[i].node = NULL;
+    idx->count--;
+
+    j = i;
+    while (1) {
+        j = (j+1) & mask;
+        if (idx->slots[j].node == NULL) break;
+        k = idx->slots[j].hash & mask;
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        idx->slots[i] = idx->slots[j];
+        idx->slots[j].node = NULL;
+        i = j;
+    }
+}
+
+static unsigned int hash_ino(const uint64_t ino)
+{
+    return (unsigned int)(ino ^ (ino >> 32)) * 2654435761u;
+}
+
+/*
+64-bit FNV-1a of the id, used as the preferred inode number of a node
+*/
+static uint64_t ino_from_id(const char *id)
+{
+    uint64_t hash = 14695981039346656037ull;
+    int i;
+
+    for (i=0; i<32; i++) {
+        hash ^= (unsigned char)id[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+static int ino_index_grow(ino_index *idx)
+{
+    ino_slot *slots;
+    int capacity, mask, i, j;
+
+    capacity = idx->capacity == 0 ? NAME_INDEX_MIN_CAPACITY : idx->capacity*2;
+    slots = calloc(capacity, sizeof(ino_slot));
+    if (slots == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+
+    mask = capacity-1;
+    for (i=0; i<idx->capacity; i++) {
+        if (idx->slots[i].node == NULL) continue;
+        j = hash_ino(idx->slots[i].ino) & mask;
+        while (slots[j].node != NULL) j = (j+1) & mask;
+        slots[j] = idx->slots[i];
+    }
+
+    free(idx->slots);
+    idx->slots = slots;
+    idx->capacity = capacity;
+
+    return 0;
+}
+
+static const ino_slot* ino_index_lookup(const ino_index *idx, const uint64_t ino)
+{
+    const ino_slot *slot;
+    int mask, i;
+
+    if (idx->capacity == 0) return NULL;
+
+    mask = idx->capacity-1;
+    i = hash_ino(ino) & mask;
+    while ((slot = &idx->slots[i])->node != NULL) {
+        if (slot->ino == ino) return slot;
+        i = (i+1) & mask;
+    }
+
+    return NULL;
+}
+
+/*
+Pick the inode number of a new node: the hash of its id, or the next free number on collision
+*/
+static uint64_t ino_index_allocate(const ino_index *idx, const char *id)
+{
+    uint64_t ino;
+
+    ino = ino_from_id(id);
+    while (ino <= DGP_ROOT_INO || ino_index_lookup(idx, ino) != NULL) ino++;
+
+    return ino;
+}
+
+static int ino_index_insert(ino_index *idx, void *node, const uint64_t ino, const char is_file)
+{
+    int mask, i;
+
+    if ((idx->count+1)*2 > idx->capacity && ino_index_grow(idx) == -1) return -1;
+
+    mask = idx->capacity-1;
+    i = hash_ino(ino) & mask;
+    while (idx->slots[i].node != NULL) i = (i+1) & mask;
+    idx->slots[i].ino = ino;
+    idx->slots[i].is_file = is_file;
+    idx->slots[i].node = node;
+    idx->count++;
+
+    return 0;
+}
+
+static void ino_index_remove(ino_index *idx, const uint64_t ino)
+{
+    int mask, i, j, k;
+
+    if (idx->capacity == 0) return;
+
+    mask = idx->capacity-1;
+    i = hash_ino(ino) & mask;
+    while (idx->slots[i].ino != ino || idx->slots[i].node == NULL) {
+        if (idx->slots[i].node == NULL) return;
+        i = (i+1) & mask;
+    }
+    idx->slots[i].node = NULL;
+    idx->count--;
+
+    j = i;
+    while (1) {
+        j = (j+1) & mask;
+        if (idx->slots[j].node == NULL) break;
+        k = hash_ino(idx->slots[j].ino) & mask;
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j)) continue;
+        idx->slots[i] = idx->slots[j];
+        idx->slots[j].node = NULL;
+        i = j;
+    }
+}
+
+static void tree_pool_init(tree_pool *pool, const size_t item_size)
+{
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->item_size = (item_size + sizeof(void*)-1) & ~(sizeof(void*)-1);
+    pool->nb_items = POOL_MIN_ITEMS;
+}
+
+static void* tree_pool_alloc(tree_pool *pool)
+{
+    tree_chunk *chunk;
+    void *item;
+
+    if (pool->free_list != NULL) {
+        item = pool->free_list;
+        pool->free_list = *(void**)item;
+        return item;
+    }
+
+    chunk = pool->chunks;
+    if (chunk == NULL || chunk->used + pool->item_size > chunk->size) {
+        chunk = malloc(sizeof(tree_chunk) + pool->nb_items*pool->item_size);
+        if (chunk == NULL) {
+            perror("malloc()");
+            return NULL;
+        }
+        chunk->size = pool->nb_items*pool->item_size;
+        chunk->used = 0;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+        if (pool->nb_items < POOL_MAX_ITEMS) pool->nb_items *= 2;
+    }
+
+    item = chunk->data + chunk->used;
+    chunk->used += pool->item_size;
+
+    return item;
+}
+
+static void tree_pool_release(tree_pool *pool, void *item)
+{
+    *(void**)item = pool->free_list;
+    pool->free_list = item;
+}
+
+static void tree_chunks_free(tree_chunk *chunk)
+{
+    tree_chunk *next;
+
+    while (chunk != NULL) {
+        next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+/*
+Copy name into the names region of the arena
+*/
+static char* tree_strdup(c_tree *tree, const char *name)
+{
+    tree_chunk *chunk;
+    size_t len, size;
+    char *ptr;
+
+    len = strlen(name)+1;
+    chunk = tree->names;
+    if (chunk == NULL || chunk->used + len > chunk->size) {
+        size = chunk == NULL ? NAMES_MIN_CHUNK : chunk->size;
+        if (size < NAMES_MAX_CHUNK) size *= 2;
+        if (size < len) size = len;
+        chunk = malloc(sizeof(tree_chunk) + size);
+        if (chunk == NULL) {
+            perror("malloc()");
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = tree->names;
+        tree->names = chunk;
+    }
+
+    ptr = chunk->data + chunk->used;
+    memcpy(ptr, name, len);
+    chunk->used += len;
+
+    return ptr;
+}
+
+/*
+Make room for one more entry into a child table, doubling its capacity when full
+*/
+static int table_reserve(void **table, int *capacity, const int nb, const size_t entry_size)
+{
+    void *ptr;
+    int new_capacity;
+
+    if (nb < *capacity) return 0;
+
+    new_capacity = *capacity == 0 ? TABLE_MIN_CAPACITY : *capacity*2;
+    ptr = realloc(*table, new_capacity*entry_size);
+    if (ptr == NULL) {
+        perror("realloc()");
+        return -1;
+    }
+    *table = ptr;
+    *capacity = new_capacity;
+
+    return 0;
+}
+
+/*
+Release the per-folder allocations of a folder and all its descendants
+Nodes and names are left to the arena
+*/
+static void release_folder_rec(c_folder *folder)
+{
+    int i;
+
+    for (i=0; i<folder->nb_files; i++) {
+        free(folder->files[i]->cache_path);
+        free(folder->files[i]->blocks);
+        pthread_mutex_destroy(&folder->files[i]->lock);
+        pthread_cond_destroy(&folder->files[i]->landed_cond);
+    }
+    for (i=0; i<folder->nb_folders; i++) release_folder_rec(folder->folders[i]);
+
+    free(folder->files);
+    free(folder->folders);
+    name_index_free(&folder->folders_index);
+    name_index_free(&folder->files_index);
+    free(folder->meta);
+}
+
+static void meta_release(void *ptr, void *arg)
+{
+    (void)arg;
+    free(ptr);
+}
+
+/*
+Unpublish the compact listing of folder and retire it, it may still be in use by lock-free readers
+*/
+static void meta_unpublish(c_folder *folder)
+{
+    c_meta *meta;
+
+    meta = __atomic_exchange_n(&folder->meta, NULL, __ATOMIC_ACQ_REL);
+    if (meta != NULL) epoch_retire(meta_release, meta, NULL);
+}
+
+/*
+Drop the compact listing of folder, and of its parent whose link count of folder is affected
+*/
+static void meta_invalidate(c_folder *folder, const char with_parent)
+{
+    meta_unpublish(folder);
+    if (with_parent && folder->parent != NULL) meta_unpublish(folder->parent);
+}
+
+/*
+Return a removed folder node to its pool, once no lock-free reader can reach it
+*/
+static void folder_release(void *ptr, void *arg)
+{
+    tree_pool_release(arg, ptr);
+}
+
+/*
+Link file at the end of the files table of parent
+Return -1 on error, 0 otherwise
+*/
+static int attach_file(c_folder *parent, c_file *file)
+{
+    if (table_reserve((void**)&parent->files, &parent->files_capacity, parent->nb_files, sizeof(c_file*)) == -1)
+        return -1;
+    if (name_index_insert(&parent->files_index, file->name_hash, parent->nb_files) == -1) return -1;
+
+    file->parent = parent;
+    file->parent_index = parent->nb_files;
+    file->parent_seq = parent->next_seq++;
+    parent->files[parent->nb_files] = file;
+    parent->nb_files++;
+    meta_invalidate(parent, 0);
+
+    return 0;
+}
+
+/*
+Unlink the file at index from the files table of parent and compact the table
+*/
+static c_file* detach_file(c_folder *parent, const int index)
+{
+    c_file *file;
+    int i;
+
+    file = parent->files[index];
+    name_index_remove(&parent->files_index, file->name_hash, index, 1);
+
+    memmove(parent->files+index, parent->files+index+1, (parent->nb_files-index-1)*sizeof(c_file*));
+    parent->nb_files--;
+    for (i=index; i<parent->nb_files; i++) parent->files[i]->parent_index = i;
+    meta_invalidate(parent, 0);
+
+    return file;
+}
+
+/*
+Link folder at the end of the folders table of parent
+Return -1 on error, 0 otherwise
+*/
+static int attach_folder(c_folder *parent, c_folder *folder)
+{
+    if (table_reserve((void**)&parent->folders, &parent->folders_capacity, parent->nb_folders, sizeof(c_folder*)) == -1)
+        return -1;
+    if (name_index_insert(&parent->folders_index, folder->name_hash, parent->nb_folders) == -1) return -1;
+
+    folder->parent = parent;
+    folder->parent_index = parent->nb_folders;
+    folder->parent_seq = parent->next_seq++;
+    parent->folders[parent->nb_folders] = folder;
+    parent->nb_folders++;
+    meta_invalidate(parent, 1);
+    meta_unpublish(folder);
+
+    return 0;
+}
+
+/*
+Unlink folder from the folders table of its parent and compact the table
+*/
+static void detach_folder(c_folder *folder)
+{
+    c_folder *parent;
+    int index, i;
+
+    parent = folder->parent;
+    index = folder->parent_index;
+    name_index_remove(&parent->folders_index, folder->name_hash, index, 1);
+
+    memmove(parent->folders+index, parent->folders+index+1, (parent->nb_folders-index-1)*sizeof(c_folder*));
+    parent->nb_folders--;
+    for (i=index; i<parent->nb_folders; i++) parent->folders[i]->parent_index = i;
+    meta_invalidate(parent, 1);
+}
+
+c_folder* add_folder(c_folder *parent, const char *id, const char *name)
+{
+    c_folder *new;
+    c_tree *tree;
+
     if (parent == NULL) {
-        memcpy(new->id, id, 32);
+        tree = malloc(sizeof(c_tree));
+        if (tree == NULL) {
+            perror("malloc()");
+            return NULL;
+        }
+        tree_pool_init(&tree->files, sizeof(c_file));
+        tree_pool_init(&tree->folders, sizeof(c_folder));
+        tree->names = NULL;
+        memset(&tree->ids, 0, sizeof(id_index));
+        memset(&tree->inodes, 0, sizeof(ino_index));
+
+        new = tree_pool_alloc(&tree->folders);
+        if (new == NULL) {
+            free(tree);
+            return NULL;
+        }
         new->name = NULL;
+        new->name_hash = 0;
+        new->ino = DGP_ROOT_INO;
     }
     else {
         if (id == NULL || name == NULL) {
             fputs("add_folder(): id and name cannot be NULL\n", stderr);
-            free(new);
-            return NULL;
-        }
-        memcpy(new->id, id, 32);
-        name_len = strlen(name);
-        new->name = malloc((name_len+1) * sizeof(char));
-        if (new == NULL) {
-            perror("malloc()");
-            free(new);
             return NULL;
         }
-        strncpy(new->name, name, name_len);
-        new->name[name_len] = '\0';
-
-        folder_table = realloc(parent->folders, (parent->nb_folders+1) * sizeof(c_folder*));
-        if (folder_table == NULL) {
-            perror("realloc()");
-            free(new->name);
-            free(new);
+        tree = parent->tree;
+
+        new = tree_pool_alloc(&tree->folders);
+        if (new == NULL) return NULL;
+
+        new->name = tree_strdup(tree, name);
+        if (new->name == NULL) {
+            tree_pool_release(&tree->folders, new);
             return NULL;
         }
-
-        parent->folders = folder_table;
-        parent->folders[parent->nb_folders] = new;
-        parent->nb_folders++;
+        new->name_hash = hash_name(new->name);
+        new->ino = ino_index_allocate(&tree->inodes, id);
     }
-    new->parent = parent;
+    memcpy(new->id, id, 32);
+    new->nlookup = 0;
+    new->tree = tree;
+    new->parent = NULL;
+    new->parent_index = -1;
+    new->parent_seq = 0;
+    new->next_seq = 0;
     new->nb_files = 0;
     new->nb_folders = 0;
+    new->files_capacity = 0;
+    new->folders_capacity = 0;
     new->files_loaded = 0;
+    new->seq_last = -2;
+    new->seq_run = 0;
+    new->seq_gen = 0;
     new->files = NULL;
     new->folders = NULL;
+    memset(&new->folders_index, 0, sizeof(name_index));
+    memset(&new->files_index, 0, sizeof(name_index));
+    new->meta = NULL;
+
+    if (id_index_insert(&tree->ids, new, new->id, 0) == -1) {
+        tree_pool_release(&tree->folders, new);
+        if (parent == NULL) {
+            tree_chunks_free(tree->folders.chunks);
+            free(tree);
+        }
+        return NULL;
+    }
+    if (ino_index_insert(&tree->inodes, new, new->ino, 0) == -1) {
+        id_index_remove(&tree->ids, new, new->id);
+        tree_pool_release(&tree->folders, new);
+        if (parent == NULL) {
+            free(tree->ids.slots);
+            tree_chunks_free(tree->folders.chunks);
+            free(tree);
+        }
+        return NULL;
+    }
+
+    if (parent != NULL && attach_folder(parent, new) == -1) {
+        ino_index_remove(&tree->inodes, new->ino);
+        id_index_remove(&tree->ids, new, new->id);
+        tree_pool_release(&tree->folders, new);
+        return NULL;
+    }
 
     return new;
 }
 
 c_file* add_file(c_folder *parent, const char *id, const char *name, const size_t size)
 {
-    c_file *new, **file_table;
-    int name_len = 0;
+    c_file *new;
 
     if (parent == NULL || name == NULL || id == NULL) {
         fputs("add_file(): parent, name and id cannot be NULL\n", stderr);
         return NULL;
     }
 
-    new = malloc(sizeof(c_file));
-    if (new == NULL) {
-        perror("malloc()");
-        return NULL;
-    }
+    new = tree_pool_alloc(&parent->tree->files);
+    if (new == NULL) return NULL;
 
     memcpy(new->id, id, 32);
-    name_len = strlen(name);
-    new->name = malloc((name_len+1) * sizeof(char));
-    if (new == NULL) {
-        perror("malloc()");
-        free(new);
+    new->name = tree_strdup(parent->tree, name);
+    if (new->name == NULL) {
+        tree_pool_release(&parent->tree->files, new);
         return NULL;
     }
-    strncpy(new->name, name, name_len);
-    new->name[name_len] = '\0';
+    new->name_hash = hash_name(new->name);
     new->size = size;
     new->dirty = 0;
     new->cached = 0;
+    new->pages_valid = 0;
+    new->hashed = 0;
+    new->hash = 0;
     new->cache_path = NULL;
-
-    file_table = realloc(parent->files, (parent->nb_files+1) * sizeof(c_file*));
-    if (file_table == NULL) {
-        perror("realloc()");
-        free(new->name);
-        free(new);
+    new->blocks = NULL;
+    new->blocks_missing = 0;
+    new->streaming = 0;
+    new->landed = 0;
+    new->opens = 0;
+    new->in_lru = 0;
+    new->charged = 0;
+    new->lru_prev = NULL;
+    new->lru_next = NULL;
+    new->ino = ino_index_allocate(&parent->tree->inodes, id);
+    new->nlookup = 0;
+
+    if (id_index_insert(&parent->tree->ids, new, new->id, 1) == -1) {
+        tree_pool_release(&parent->tree->files, new);
         return NULL;
     }
-
-    parent->files = file_table;
-    parent->files[parent->nb_files] = new;
-    parent->nb_files++;
+    if (ino_index_insert(&parent->tree->inodes, new, new->ino, 1) == -1) {
+        id_index_remove(&parent->tree->ids, new, new->id);
+        tree_pool_release(&parent->tree->files, new);
+        return NULL;
+    }
+    if (attach_file(parent, new) == -1) {
+        ino_index_remove(&parent->tree->inodes, new->ino);
+        id_index_remove(&parent->tree->ids, new, new->id);
+        tree_pool_release(&parent->tree->files, new);
+        return NULL;
+    }
+    pthread_mutex_init(&new->lock, NULL);
+    pthread_cond_init(&new->landed_cond, NULL);
 
     return new;
 }
 
 int remove_file(c_folder *parent, const int index)
 {
-    int i;
-    c_file *ptr, **file_table;
+    c_file *ptr;
 
     if (parent == NULL || index >= parent->nb_files || index < 0 || !parent->files_loaded) {
         fputs("remove_file(): parent is NULL or index is out of range\n", stderr);
         return -1;
     }
 
-    ptr = parent->files[index];
+    ptr = detach_file(parent, index);
+    id_index_remove(&parent->tree->ids, ptr, ptr->id);
+    ino_index_remove(&parent->tree->inodes, ptr->ino);
     free(ptr->cache_path);
-    free(ptr->name);
-    free(ptr);
-
-    for (i=index; i < parent->nb_files-1; i++)
-        parent->files[i] = parent->files[i+1];
-
-    parent->nb_files--;
-    file_table = realloc(parent->files, parent->nb_files*sizeof(c_file*));
-    if (file_table == NULL && parent->nb_files != 0) {
-        perror("realloc()");
-        return -1;
-    }
-
-    if (parent->nb_files == 0) parent->files = NULL;
-    else parent->files = file_table;
+    free(ptr->blocks);
+    pthread_mutex_destroy(&ptr->lock);
+    pthread_cond_destroy(&ptr->landed_cond);
+    tree_pool_release(&parent->tree->files, ptr);
 
     return 0;
 }
 
 int remove_folder(c_folder *folder)
 {
-    c_folder *parent, **folder_table;
-    int index, i;
+    c_folder *parent;
 
     parent = folder->parent;
 
@@ -148,22 +777,12 @@ int remove_folder(c_folder *folder)
         return -1;
     }
 
-    index = find_folder_id(parent, folder->id);
-
-    free(folder->name);
-
-    for (i=index; i < parent->nb_folders-1; i++)
-        parent->folders[i] = parent->folders[i+1];
-
-    parent->nb_folders--;
-    folder_table = realloc(parent->folders, parent->nb_folders*sizeof(c_folder*));
-    if (folder_table == NULL && parent->nb_folders != 0) {
-        perror("realloc()");
-        return -1;
-    }
-
-    if (parent->nb_folders == 0) parent->folders = NULL;
-    else parent->folders = folder_table;
+    detach_folder(folder);
+    id_index_remove(&parent->tree->ids, folder, folder->id);
+    ino_index_remove(&parent->tree->inodes, folder->ino);
+    meta_unpublish(folder);
+    release_folder_rec(folder);
+    epoch_retire(folder_release, folder, &parent->tree->folders);
 
     return 0;
 }
@@ -186,31 +805,58 @@ int remove_folder_rec(c_folder *parent, const int index)
     return remove_folder(ptr);
 }
 
-void free_root(c_folder *root)
+static void free_tree(c_folder *root)
 {
-    int i;
+    c_tree *tree;
+
+    tree = root->tree;
+    release_folder_rec(root);
+
+    tree_chunks_free(tree->files.chunks);
+    tree_chunks_free(tree->folders.chunks);
+    tree_chunks_free(tree->names);
+    free(tree->ids.slots);
+    free(tree->inodes.slots);
+    free(tree);
+}
 
+void free_root(c_folder *root)
+{
     if (root == NULL) {
         fputs("free_root(): root cannot be NULL\n", stderr);
         return;
     }
 
-    for (i=root->nb_files-1; i>=0; i--) remove_file(root, i);
-    for (i=root->nb_folders-1; i>=0; i--) remove_folder_rec(root, i);
+    //Nothing can be reading the tree anymore, retired nodes go back to the pools before these are freed
+    epoch_flush();
 
-    free(root->name);
-    free(root);
+    free_tree(root);
 }
 
-int find_file_name(const c_folder *base, const char *name)
+void free_scratch_root(c_folder *root)
 {
-    int i = 0;
+    if (root == NULL) {
+        fputs("free_scratch_root(): root cannot be NULL\n", stderr);
+        return;
+    }
 
-    if (base == NULL) return -1;
+    free_tree(root);
+}
 
-    while (i < base->nb_files) {
-        if (strcmp(base->files[i]->name, name) == 0) return i;
-        i++;
+int find_file_name(const c_folder *base, const char *name)
+{
+    const name_slot *slot;
+    unsigned int hash;
+    int mask, i;
+
+    if (base == NULL || base->files_index.capacity == 0) return -1;
+
+    hash = hash_name(name);
+    mask = base->files_index.capacity-1;
+    i = hash & mask;
+    while ((slot = &base->files_index.slots[i])->index != -1) {
+        if (slot->hash == hash && strcmp(base->files[slot->index]->name, name) == 0) return slot->index;
+        i = (i+1) & mask;
     }
 
     return -1;
@@ -218,13 +864,18 @@ int find_file_name(const c_folder *base, const char *name)
 
 int find_folder_name(const c_folder *base, const char *name)
 {
-    int i = 0;
-
-    if (base == NULL) return -1;
-
-    while (i < base->nb_folders) {
-        if (strcmp(base->folders[i]->name, name) == 0) return i;
-        i++;
+    const name_slot *slot;
+    unsigned int hash;
+    int mask, i;
+
+    if (base == NULL || base->folders_index.capacity == 0) return -1;
+
+    hash = hash_name(name);
+    mask = base->folders_index.capacity-1;
+    i = hash & mask;
+    while ((slot = &base->folders_index.slots[i])->index != -1) {
+        if (slot->hash == hash && strcmp(base->folders[slot->index]->name, name) == 0) return slot->index;
+        i = (i+1) & mask;
     }
 
     return -1;
@@ -232,107 +883,315 @@ int find_folder_name(const c_folder *base, const char *name)
 
 int find_file_id(const c_folder *base, const char *id)
 {
-    int i = 0;
+    c_file *file;
 
     if (base == NULL) return -1;
 
-    while (i < base->nb_files) {
-        if (strncmp(base->files[i]->id, id, 32) == 0) return i;
-        i++;
-    }
+    file = id_index_lookup(&base->tree->ids, id, 1);
+    if (file == NULL || file->parent != base) return -1;
 
-    return -1;
+    return file->parent_index;
 }
 
 int find_folder_id(const c_folder *base, const char *id)
 {
-    int i = 0;
+    c_folder *folder;
 
     if (base == NULL) return -1;
 
-    while (i < base->nb_folders) {
-        if (strncmp(base->folders[i]->id, id, 32) == 0) return i;
-        i++;
+    folder = id_index_lookup(&base->tree->ids, id, 0);
+    if (folder == NULL || folder->parent != base) return -1;
+
+    return folder->parent_index;
+}
+
+c_file* find_file_by_id(const c_tree *tree, const char *id)
+{
+    if (tree == NULL) return NULL;
+    return id_index_lookup(&tree->ids, id, 1);
+}
+
+c_folder* find_folder_by_id(const c_tree *tree, const char *id)
+{
+    if (tree == NULL) return NULL;
+    return id_index_lookup(&tree->ids, id, 0);
+}
+
+void* find_node_by_ino(const c_tree *tree, const uint64_t ino, char *is_file)
+{
+    const ino_slot *slot;
+
+    if (tree == NULL) return NULL;
+
+    slot = ino_index_lookup(&tree->inodes, ino);
+    if (slot == NULL) return NULL;
+
+    if (is_file != NULL) *is_file = slot->is_file;
+    return slot->node;
+}
+
+int set_file_id(c_file *file, const char *id)
+{
+    c_tree *tree;
+
+    if (file == NULL || id == NULL) {
+        fputs("set_file_id(): file and id cannot be NULL\n", stderr);
+        return -1;
     }
 
-    return -1;
+    tree = file->parent->tree;
+    id_index_remove(&tree->ids, file, file->id);
+    memcpy(file->id, id, 32);
+
+    return id_index_insert(&tree->ids, file, file->id, 1);
 }
 
-c_file* move_file(c_folder *from, c_folder *to, const int index)
+void set_file_size(c_file *file, const size_t size)
+{
+    file->size = size;
+    meta_invalidate(file->parent, 0);
+}
+
+void set_folder_loaded(c_folder *folder)
+{
+    folder->files_loaded = 1;
+    meta_invalidate(folder, 0);
+}
+
+/*
+Append one entry to the compact listing being built and index it by name
+*/
+static void meta_append(c_meta *meta, size_t *names_size, const char *name, const unsigned int name_hash, const uint64_t ino,
+                        const uint64_t size, const uint32_t nlink, const uint32_t flags, const uint64_t cookie, void *node)
 {
+    c_meta_entry *entry;
+    size_t len;
+    int mask, i;
+
+    len = strlen(name)+1;
+    entry = &meta->entries[meta->nb_entries];
+    entry->ino = ino;
+    entry->size = size;
+    entry->name_off = *names_size;
+    entry->name_hash = name_hash;
+    entry->nlink = nlink;
+    entry->flags = flags;
+    entry->cookie = cookie;
+    entry->node = node;
+    memcpy(meta->names + *names_size, name, len);
+    *names_size += len;
+
+    mask = meta->slots_capacity-1;
+    i = name_hash & mask;
+    while (meta->slots[i] != -1) i = (i+1) & mask;
+    meta->slots[i] = meta->nb_entries;
+    meta->nb_entries++;
+}
+
+/*
+Build the compact listing of folder into a single allocation
+Return NULL on error
+*/
+static c_meta* meta_build(const c_folder *folder)
+{
+    c_meta *meta;
+    c_folder *child;
     c_file *file;
-    int cache_path_len;
+    size_t names_size, entries_size, slots_size;
+    int nb, capacity, i;
+
+    nb = folder->nb_folders + folder->nb_files;
+    names_size = 0;
+    for (i=0; i<folder->nb_folders; i++) names_size += strlen(folder->folders[i]->name)+1;
+    for (i=0; i<folder->nb_files; i++) names_size += strlen(folder->files[i]->name)+1;
+    capacity = NAME_INDEX_MIN_CAPACITY;
+    while (capacity < nb*2) capacity *= 2;
+
+    entries_size = nb*sizeof(c_meta_entry);
+    slots_size = capacity*sizeof(int);
+    meta = malloc(sizeof(c_meta) + entries_size + slots_size + names_size);
+    if (meta == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+    meta->entries = (c_meta_entry*)(meta+1);
+    meta->slots = (int*)((char*)meta->entries + entries_size);
+    meta->names = (char*)meta->slots + slots_size;
+    meta->nb_entries = 0;
+    meta->nb_folders = folder->nb_folders;
+    meta->slots_capacity = capacity;
+    meta->parent_ino = folder->parent != NULL ? folder->parent->ino : folder->ino;
+    meta->files_loaded = folder->files_loaded;
+    memset(meta->slots, -1, slots_size);
+
+    names_size = 0;
+    for (i=0; i<folder->nb_folders; i++) {
+        child = folder->folders[i];
+        meta_append(meta, &names_size, child->name, child->name_hash, child->ino, 0, 2 + child->nb_folders, META_DIR,
+                    3 + child->parent_seq, child);
+    }
+    for (i=0; i<folder->nb_files; i++) {
+        file = folder->files[i];
+        meta_append(meta, &names_size, file->name, file->name_hash, file->ino, file->size, 1, 0,
+                    META_FILE_COOKIE + file->parent_seq, file);
+    }
 
-    file = add_file(to, from->files[index]->id, from->files[index]->name, from->files[index]->size);
-    if (file == NULL) return NULL;
+    return meta;
+}
 
-    file->cached = from->files[index]->cached;
-    file->dirty = from->files[index]->dirty;
-    if (file->cached) {
-        cache_path_len = strlen(from->files[index]->cache_path);
-        file->cache_path = malloc(cache_path_len+1);
-        if (file->cache_path == NULL) {
-            perror("malloc()");
-            return NULL;
-        }
-        memcpy(file->cache_path, from->files[index]->cache_path, cache_path_len+1);
+const c_meta* get_folder_meta(c_folder *folder)
+{
+    c_meta *meta, *published;
+
+    if (folder == NULL) return NULL;
+
+    published = __atomic_load_n(&folder->meta, __ATOMIC_ACQUIRE);
+    if (published != NULL) return published;
+
+    meta = meta_build(folder);
+    if (meta == NULL) return NULL;
+
+    //Another reader may have published the same listing meanwhile, keep the first one
+    if (!__atomic_compare_exchange_n(&folder->meta, &published, meta, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(meta);
+        return published;
     }
 
-    if (remove_file(from, index) == -1) return NULL;
-    
-    return file;
+    return meta;
 }
 
-c_folder* move_folder(c_folder *folder, c_folder *to)
+const c_meta* peek_folder_meta(const c_folder *folder)
 {
-    c_folder *new_folder, *parent, **folder_table;
-    int index, i;
+    return __atomic_load_n(&folder->meta, __ATOMIC_ACQUIRE);
+}
 
-    parent = folder->parent;
+const c_meta_entry* find_meta_entry(const c_meta *meta, const char *name)
+{
+    const c_meta_entry *entry;
+    unsigned int hash;
+    int mask, i;
+
+    hash = hash_name(name);
+    mask = meta->slots_capacity-1;
+    i = hash & mask;
+    while (meta->slots[i] != -1) {
+        entry = &meta->entries[meta->slots[i]];
+        if (entry->name_hash == hash && strcmp(meta->names + entry->name_off, name) == 0) return entry;
+        i = (i+1) & mask;
+    }
 
-    index = find_folder_id(parent, folder->id);
-    if (index == -1) {
-        fputs("move_folder(): Unexpected error\n", stderr);
-        return NULL;
+    return NULL;
+}
+
+int find_meta_cookie(const c_meta *meta, const uint64_t cookie)
+{
+    int low, high, mid;
+
+    //The tables of a folder keep the order in which children were added, so entries are sorted by cookie
+    low = 0;
+    high = meta->nb_entries;
+    while (low < high) {
+        mid = low + (high-low)/2;
+        if (meta->entries[mid].cookie <= cookie) low = mid+1;
+        else high = mid;
     }
 
-    new_folder = add_folder(to, folder->id, folder->name);
-    if (new_folder == NULL) return NULL;
+    return low;
+}
 
-    new_folder->files_loaded = folder->files_loaded;
-    new_folder->nb_files = folder->nb_files;
-    new_folder->nb_folders = folder->nb_folders;
+int rename_file(c_folder *parent, const int index, const char *name)
+{
+    c_file *file;
+    char *ptr;
+    unsigned int hash;
 
-    new_folder->files = malloc(new_folder->nb_files * sizeof(c_file*));
-    if (new_folder->files == NULL) {
-        perror("malloc()");
-        return NULL;
+    if (parent == NULL || name == NULL || index >= parent->nb_files || index < 0) {
+        fputs("rename_file(): parent or name is NULL or index is out of range\n", stderr);
+        return -1;
     }
-    new_folder->folders = malloc(new_folder->nb_folders * sizeof(c_folder*));
-    if (new_folder->folders == NULL) {
-        perror("malloc()");
+
+    file = parent->files[index];
+    ptr = tree_strdup(parent->tree, name);
+    if (ptr == NULL) return -1;
+
+    //The new name is indexed first, so that the file is still found by its old one on failure
+    hash = hash_name(ptr);
+    if (name_index_insert(&parent->files_index, hash, index) == -1) return -1;
+    name_index_remove(&parent->files_index, file->name_hash, index, 0);
+    meta_invalidate(parent, 0);
+    file->name = ptr;
+    file->name_hash = hash;
+
+    return 0;
+}
+
+int rename_folder(c_folder *folder, const char *name)
+{
+    c_folder *parent;
+    char *ptr;
+    unsigned int hash;
+    int index;
+
+    if (folder == NULL || name == NULL || folder->parent == NULL) {
+        fputs("rename_folder(): folder or name is NULL or folder is root\n", stderr);
+        return -1;
+    }
+
+    parent = folder->parent;
+    index = folder->parent_index;
+
+    ptr = tree_strdup(parent->tree, name);
+    if (ptr == NULL) return -1;
+
+    hash = hash_name(ptr);
+    if (name_index_insert(&parent->folders_index, hash, index) == -1) return -1;
+    name_index_remove(&parent->folders_index, folder->name_hash, index, 0);
+    meta_invalidate(parent, 0);
+    folder->name = ptr;
+    folder->name_hash = hash;
+
+    return 0;
+}
+
+c_file* move_file(c_folder *from, c_folder *to, const int index)
+{
+    c_file *file;
+
+    if (from == NULL || to == NULL || index >= from->nb_files || index < 0) {
+        fputs("move_file(): from or to is NULL or index is out of range\n", stderr);
         return NULL;
     }
 
-    memcpy(new_folder->files, folder->files, new_folder->nb_files*sizeof(c_file*));
-    for (i=0; i<new_folder->nb_folders; i++) {
-        new_folder->folders[i] = folder->folders[i];
-        new_folder->folders[i]->parent = new_folder;
+    if (table_reserve((void**)&to->files, &to->files_capacity, to->nb_files, sizeof(c_file*)) == -1)
+        return NULL;
+
+    file = detach_file(from, index);
+    if (attach_file(to, file) == -1) {
+        attach_file(from, file);
+        return NULL;
     }
 
-    free(folder->name);
-    for (i=index; i < parent->nb_folders-1; i++)
-        parent->folders[i] = parent->folders[i+1];
-    
-    parent->nb_folders--;
-    folder_table = realloc(parent->folders, parent->nb_folders*sizeof(c_folder*));
-    if (folder_table == NULL && parent->nb_folders != 0) {
-        perror("realloc()");
+    return file;
+}
+
+c_folder* move_folder(c_folder *folder, c_folder *to)
+{
+    c_folder *parent;
+
+    parent = folder->parent;
+    if (parent == NULL || to == NULL) {
+        fputs("move_folder(): Cannot move root or move to NULL\n", stderr);
         return NULL;
     }
 
-    if (parent->nb_folders == 0) parent->folders = NULL;
-    else parent->folders = folder_table;
+    if (table_reserve((void**)&to->folders, &to->folders_capacity, to->nb_folders, sizeof(c_folder*)) == -1)
+        return NULL;
+
+    detach_folder(folder);
+    if (attach_folder(to, folder) == -1) {
+        attach_folder(parent, folder);
+        return NULL;
+    }
 
-    return new_folder;
+    return folder;
 }
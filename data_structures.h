@@ -1,37 +1,207 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
+#include "epoch.h"
 
 #ifndef DGP_DTSTRUCT_H
 #define DGP_DTSTRUCT_H
 
+#define DGP_ROOT_INO 1
+
+/*
+Open-addressing hash index over the names of a files or folders table
+Each slot holds the cached hash of the name and the index of the entry into the table
+An empty slot has an index of -1
+*/
+typedef struct name_slot {
+    unsigned int hash;
+    int index;
+} name_slot;
+
+typedef struct name_index {
+    name_slot *slots;
+    int capacity;
+    int count;
+} name_index;
+
+/*
+Open-addressing hash index from object id to node, shared by the whole tree
+An empty slot has a NULL node
+*/
+typedef struct id_slot {
+    unsigned int hash;
+    char is_file;
+    void *node;
+} id_slot;
+
+typedef struct id_index {
+    id_slot *slots;
+    int capacity;
+    int count;
+} id_index;
+
+/*
+Open-addressing hash index from inode number to node, shared by the whole tree
+An empty slot has a NULL node
+*/
+typedef struct ino_slot {
+    uint64_t ino;
+    char is_file;
+    void *node;
+} ino_slot;
+
+typedef struct ino_index {
+    ino_slot *slots;
+    int capacity;
+    int count;
+} ino_index;
+
+/*
+Compact listing of the children of a folder, child folders first then child files
+Names are stored back to back in one blob and referenced by offset
+slots is an open-addressing hash index of the entries by name, an empty slot is -1
+A listing is never modified once published by get_folder_meta()
+Any change to the folder unpublishes it and retires it through epoch_retire()
+so lock-free readers may use it from within an epoch
+node is the c_folder or c_file behind the entry, only folders may be dereferenced by such readers
+cookie is the readdir offset of the entry, kept across rebuilds: entries grow with it, child folders
+from 3 on, after "." and "..", and child files from META_FILE_COOKIE on
+*/
+#define META_DIR 1
+#define META_FILE_COOKIE ((uint64_t)1 << 62)
+
+typedef struct c_meta_entry {
+    uint64_t ino;
+    uint64_t size;
+    uint32_t name_off;
+    uint32_t name_hash;
+    uint32_t nlink;
+    uint32_t flags;
+    uint64_t cookie;
+    void *node;
+} c_meta_entry;
+
+typedef struct c_meta {
+    c_meta_entry *entries;
+    char *names;
+    int *slots;
+    int nb_entries;
+    int nb_folders;
+    int slots_capacity;
+    uint64_t parent_ino;
+    char files_loaded;
+} c_meta;
+
+/*
+Tree arena
+Nodes are carved from slab pools and recycled through a free list
+Names are bump-allocated and only released as a whole by free_root()
+*/
+typedef struct tree_chunk {
+    struct tree_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} tree_chunk;
+
+typedef struct tree_pool {
+    tree_chunk *chunks;
+    void *free_list;
+    size_t item_size;
+    size_t nb_items;
+} tree_pool;
+
+typedef struct c_tree {
+    tree_pool files;
+    tree_pool folders;
+    tree_chunk *names;
+    id_index ids;
+    ino_index inodes;
+} c_tree;
+
+/*
+The lock of a file guards its cache state (dirty, cached, cache_path, pages_valid, blocks) against concurrent faults
+pages_valid is set once the kernel page cache may hold the current content of the cached copy
+A cached copy being filled block by block has cached unset and a bitmap of the blocks present in blocks
+A cached copy being downloaded in the background has streaming set and its first landed bytes written,
+landed_cond is signaled with the lock of the file whenever they change
+opens counts the handles open on the cached copy
+hash is the content hash of the document, valid while hashed is set, uploads of a copy still matching it are skipped
+It is always taken after the tree lock of the filesystem, never before
+in_lru, charged, lru_prev and lru_next belong to the cache_lru holding the cached copy, if any, and are guarded by its lock
+parent_seq numbers the file among the children of its parent in the order they were added, renames keep it
+*/
 typedef struct c_file {
     char id[32];
     char *name;
+    unsigned int name_hash;
     size_t size;
     char dirty;
     char cached;
+    char pages_valid;
+    char hashed;
+    uint64_t hash;
     char *cache_path;
+    unsigned char *blocks;
+    size_t blocks_missing;
+    char streaming;
+    uint64_t landed;
+    pthread_mutex_t lock;
+    pthread_cond_t landed_cond;
+    int opens;
+    char in_lru;
+    size_t charged;
+    struct c_file *lru_prev;
+    struct c_file *lru_next;
+    uint64_t ino;
+    uint64_t nlookup;
+
+    struct c_folder *parent;
+    int parent_index;
+    uint64_t parent_seq;
 } c_file;
 
+/*
+seq_last is the index of the last file opened into files table, seq_run the number of files opened in a row from it
+seq_gen changes whenever that run breaks, so that files queued for the former run may be told apart
+They are only hints kept by the filesystem, the tree itself never reads them
+parent_seq numbers the folder among the children of its parent, next_seq is the number of the next child added to it
+*/
 typedef struct c_folder {
     char id[32];
     char *name;
+    unsigned int name_hash;
     int nb_folders;
     int nb_files;
+    int folders_capacity;
+    int files_capacity;
     char files_loaded;
+    int seq_last;
+    int seq_run;
+    int seq_gen;
+    uint64_t ino;
+    uint64_t nlookup;
 
+    c_tree *tree;
     struct c_folder *parent;
+    int parent_index;
+    uint64_t parent_seq;
+    uint64_t next_seq;
     struct c_folder **folders;
     c_file **files;
+    name_index folders_index;
+    name_index files_index;
+    c_meta *meta;
 } c_folder;
 
 /*
 Create and add a new folder into its parent
 The new folder have no child folders or child files at creation
-If the parent, id and name are NULL, its the root folder
+If the parent and name are NULL, its the root folder and a new tree arena is created
 Return a pointer to the new folder object
 Return NULL on error
 */
@@ -68,10 +238,16 @@ Return -1 on error, 0 otherwise
 int remove_folder_rec(c_folder *parent, const int index);
 
 /*
-Free memory
+Free the whole tree and its arena
 */
 void free_root(c_folder *root);
 
+/*
+Free a whole tree that nothing was ever retired from, e.g. one only built to be compared with another
+Unlike free_root(), it does not flush the retired memory of the other trees, which may still be read
+*/
+void free_scratch_root(c_folder *root);
+
 /*
 Find a file by its name
 Return the index of the file into files table
@@ -89,26 +265,103 @@ int find_folder_name(const c_folder *base, const char *name);
 /*
 Find a file by its id
 Return the index of the file into files table
-Return -1 if not found
+Return -1 if not found or if the file is not a child of base
 */
 int find_file_id(const c_folder *base, const char *id);
 
 /*
 Find a folder by its id
 Return the index of the file into folders table
-Return -1 if not found
+Return -1 if not found or if the folder is not a child of base
 */
 int find_folder_id(const c_folder *base, const char *id);
 
 /*
-Move the file at index from a folder to another
+Find a file anywhere in the tree by its id
+Return NULL if not found
+*/
+c_file* find_file_by_id(const c_tree *tree, const char *id);
+
+/*
+Find a folder anywhere in the tree by its id
+Return NULL if not found
+*/
+c_folder* find_folder_by_id(const c_tree *tree, const char *id);
+
+/*
+Find a node by its inode number
+Inode numbers are derived from the object id at creation and never change afterwards
+Set is_file to tell whether the node is a c_file or a c_folder
+Return NULL if not found
+*/
+void* find_node_by_ino(const c_tree *tree, const uint64_t ino, char *is_file);
+
+/*
+Change the id of a file and update the id index
+The inode number of the file is kept
 Return -1 on error, 0 otherwise
 */
+int set_file_id(c_file *file, const char *id);
+
+/*
+Set the size of a file and keep the listing of its parent up to date
+*/
+void set_file_size(c_file *file, const size_t size);
+
+/*
+Return the compact listing of the children of folder, building and publishing it if needed
+The tree must not change meanwhile, concurrent callers are fine
+The listing stays valid until the next change to the folder or its children, or for as long as the caller stays in its epoch
+Return NULL on error
+*/
+const c_meta* get_folder_meta(c_folder *folder);
+
+/*
+Return the published listing of folder without building it, for lock-free readers within an epoch
+Return NULL if there is none
+*/
+const c_meta* peek_folder_meta(const c_folder *folder);
+
+/*
+Find a child by its name into a listing
+Child folders are found first, as with find_folder_name() then find_file_name()
+Return NULL if not found
+*/
+const c_meta_entry* find_meta_entry(const c_meta *meta, const char *name);
+
+/*
+Return the index of the first entry of a listing past the readdir offset cookie, nb_entries if there is none
+*/
+int find_meta_cookie(const c_meta *meta, const uint64_t cookie);
+
+/*
+Mark the files of folder as loaded, once they have all been added
+*/
+void set_folder_loaded(c_folder *folder);
+
+/*
+Rename the file at index into files table of parent
+Return -1 on error, 0 otherwise
+*/
+int rename_file(c_folder *parent, const int index, const char *name);
+
+/*
+Rename the folder
+Return -1 on error, 0 otherwise
+*/
+int rename_folder(c_folder *folder, const char *name);
+
+/*
+Move the file at index from a folder to another
+The file object is relinked, not copied: it keeps its address and its cache state
+Return the moved file, NULL on error
+*/
 c_file* move_file(c_folder *from, c_folder *to, const int index);
 
 /*
 Move the folder to another folder
-Return -1 on error, 0 otherwise
+The folder object is relinked with its whole subtree, nothing is copied
+Return the moved folder, NULL on error
 */
 c_folder* move_folder(c_folder *folder, c_folder *to);
 
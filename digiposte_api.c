@@ -5,6 +5,7 @@
 #include "digiposte_api.h"
 
 static int read_fd, write_fd;
+static pthread_mutex_t api_lock = PTHREAD_MUTEX_INITIALIZER;
 
 int init_api()
 {
@@ -103,9 +104,11 @@ c_folder* get_folders()
     rs->response_actual_size = 0;
     rs->response_allocated_size = BUF_SIZE;
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, "get_folders_tree\n", 17);
     if (r != 17) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         free(rs->ptr);
         free(rs);
         return NULL;
@@ -115,6 +118,7 @@ c_folder* get_folders()
         r = read(read_fd, rs->ptr + rs->response_actual_size, CHUNK_SIZE);
         if (r == -1) {
             perror("read()");
+            pthread_mutex_unlock(&api_lock);
             free(rs->ptr);
             free(rs);
             return NULL;
@@ -127,6 +131,7 @@ c_folder* get_folders()
             tmp = realloc(rs->ptr, rs->response_actual_size + CHUNK_SIZE*2);
             if (tmp == NULL) {
                 perror("realloc()");
+                pthread_mutex_unlock(&api_lock);
                 free(rs->ptr);
                 free(rs);
                 return NULL;
@@ -135,6 +140,7 @@ c_folder* get_folders()
             rs->response_allocated_size = rs->response_actual_size + CHUNK_SIZE*2;
         }
     } while (r == CHUNK_SIZE);
+    pthread_mutex_unlock(&api_lock);
     
     if (rs->ptr[0] == 'e' && rs->ptr[1] == 'r' && rs->ptr[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -167,54 +173,56 @@ c_folder* get_folders()
     return folder;
 }
 
-int get_folder_content(c_folder *folder)
+char* fetch_folder_content(const char *id)
 {
-    json_object *root, *j_file, *field_id, *field_name, *field_size, *tmp;
     resp_stuct *rs;
-    char req[64], *tmp_ptr;
-    int r, i, n;
+    char req[64], *tmp_ptr, *response;
+    int r, i;
 
     rs = malloc(sizeof(resp_stuct));
     if (rs == NULL) {
         perror("malloc()");
-        return -1;
+        return NULL;
     }
     rs->ptr = malloc(BUF_SIZE*sizeof(char));
     if (rs->ptr == NULL) {
         perror("malloc()");
         free(rs);
-        return -1;
+        return NULL;
     }
     rs->response_actual_size = 0;
     rs->response_allocated_size = BUF_SIZE;
     
-    if (folder->id[0] == 'r') {
+    if (id[0] == 'r') {
         memcpy(req, "get_folder_content", 19);
         req[19] = '\n';
         i = 20;
     }
     else {
         memcpy(req, "get_folder_content", 19);
-        memcpy(req+19, folder->id, 32);
+        memcpy(req+19, id, 32);
         req[51] = '\n';
         i = 52;
     }
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, i);
     if (r != i) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         free(rs->ptr);
         free(rs);
-        return -1;
+        return NULL;
     }
     
     do {
         r = read(read_fd, rs->ptr + rs->response_actual_size, CHUNK_SIZE);
         if (r == -1) {
             perror("read()");
+            pthread_mutex_unlock(&api_lock);
             free(rs->ptr);
             free(rs);
-            return -1;
+            return NULL;
         }
         
         rs->response_actual_size += r;
@@ -224,27 +232,40 @@ int get_folder_content(c_folder *folder)
             tmp_ptr = realloc(rs->ptr, rs->response_actual_size + CHUNK_SIZE*2);
             if (tmp_ptr == NULL) {
                 perror("realloc()");
+                pthread_mutex_unlock(&api_lock);
                 free(rs->ptr);
                 free(rs);
-                return -1;
+                return NULL;
             }
             rs->ptr = tmp_ptr;
             rs->response_allocated_size = rs->response_actual_size + CHUNK_SIZE*2;
         }
     } while (r == CHUNK_SIZE);
+    pthread_mutex_unlock(&api_lock);
     
-    if (rs->ptr[0] == 'e' && rs->ptr[1] == 'r' && rs->ptr[2] == 'r') {
+    response = rs->ptr;
+    free(rs);
+
+    if (response[0] == 'e' && response[1] == 'r' && response[2] == 'r') {
         fputs("API returned an error\n", stderr);
-        free(rs->ptr);
-        free(rs);
-        return -1;
+        free(response);
+        return NULL;
     }
 
-    root = json_tokener_parse(rs->ptr);
+    return response;
+}
+
+int add_folder_content(c_folder *folder, char *response)
+{
+    json_object *root, *j_file, *field_id, *field_name, *field_size, *tmp;
+    int i, n;
+
+    if (response == NULL) return -1;
+
+    root = json_tokener_parse(response);
     if (root == NULL) {
         fputs("json_tokener_parse(): error\n", stderr);
-        free(rs->ptr);
-        free(rs);
+        free(response);
         return -1;
     }
 
@@ -258,18 +279,22 @@ int get_folder_content(c_folder *folder)
         add_file(folder, json_object_get_string(field_id), json_object_get_string(field_name), json_object_get_int(field_size));
     }
 
-    folder->files_loaded = 1;
+    set_folder_loaded(folder);
 
     json_object_put(root);
-    free(rs->ptr);
-    free(rs);
+    free(response);
 
     return 0;
 }
 
+int get_folder_content(c_folder *folder)
+{
+    return add_folder_content(folder, fetch_folder_content(folder->id));
+}
+
 int get_file(const c_file *file, const char *dest_path)
 {
-    char req[128], resp[4];
+    char req[BUF_SIZE], resp[4];
     int r, len;
     
     memcpy(req, "get_file", 9);
@@ -279,17 +304,21 @@ int get_file(const c_file *file, const char *dest_path)
     memcpy(req+42, dest_path, len);
     req[42+len] = '\n';
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, len+43);
     if (r != len+43) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
     
     r = read(read_fd, resp, 4);
     if (r == -1) {
         perror("read()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
+    pthread_mutex_unlock(&api_lock);
     
     if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -303,6 +332,111 @@ int get_file(const c_file *file, const char *dest_path)
     return 0;
 }
 
+int get_file_if(const c_file *file, const char *dest_path, char *etag)
+{
+    char req[BUF_SIZE], resp[DGP_ETAG_SIZE+4];
+    int r, len, etag_len;
+
+    len = strlen(dest_path);
+    etag_len = strlen(etag);
+    if (47 + len + etag_len > BUF_SIZE) {
+        fputs("get_file_if(): path too long\n", stderr);
+        return -1;
+    }
+    memcpy(req, "get_file_if", 12);
+    memcpy(req+12, file->id, 32);
+    req[44] = '\0';
+    memcpy(req+45, dest_path, len+1);
+    len += 46;
+    memcpy(req+len, etag, etag_len);
+    len += etag_len;
+    req[len++] = '\n';
+
+    pthread_mutex_lock(&api_lock);
+    r = write(write_fd, req, len);
+    if (r != len) {
+        perror("write()");
+        pthread_mutex_unlock(&api_lock);
+        return -1;
+    }
+
+    r = read(read_fd, resp, sizeof(resp));
+    if (r == -1) {
+        perror("read()");
+        pthread_mutex_unlock(&api_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&api_lock);
+
+    if (r < 3 || resp[r-1] != '\0') {
+        fputs("API returned an unexpected error\n", stderr);
+        return -1;
+    }
+    if (!strcmp(resp, "err")) {
+        fputs("API returned an error\n", stderr);
+        return -1;
+    }
+    if (!strcmp(resp, "same")) return 1;
+    if (resp[0] != 'O' || resp[1] != 'K' || resp[2] != ' ') {
+        fputs("API returned an unexpected error\n", stderr);
+        return -1;
+    }
+
+    //A longer etag could not be matched later, the copy is then only known by its id and size
+    if (r-4 < DGP_ETAG_SIZE) memcpy(etag, resp+3, r-3);
+    else etag[0] = '\0';
+
+    return 0;
+}
+
+int get_file_range(const char *id, const char *dest_path, const uint64_t offset, const uint64_t length)
+{
+    char req[BUF_SIZE], resp[4];
+    int r, len;
+
+    //Each number takes up to 20 digits and its separator
+    len = strlen(dest_path);
+    if (49 + len + 2*21 > BUF_SIZE) {
+        fputs("get_file_range(): path too long\n", stderr);
+        return -1;
+    }
+    memcpy(req, "get_file_range", 15);
+    memcpy(req+15, id, 32);
+    req[47] = '\0';
+    memcpy(req+48, dest_path, len+1);
+    len += 49;
+    len += snprintf(req+len, sizeof(req)-len, "%lu", (unsigned long)offset) + 1;
+    len += snprintf(req+len, sizeof(req)-len, "%lu\n", (unsigned long)length);
+
+    pthread_mutex_lock(&api_lock);
+    r = write(write_fd, req, len);
+    if (r != len) {
+        perror("write()");
+        pthread_mutex_unlock(&api_lock);
+        return -1;
+    }
+
+    r = read(read_fd, resp, 4);
+    if (r == -1) {
+        perror("read()");
+        pthread_mutex_unlock(&api_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&api_lock);
+
+    if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
+        fputs("API returned an error\n", stderr);
+        return -1;
+    }
+    if (resp[0] == 'a' && resp[1] == 'l' && resp[2] == 'l') return 1;
+    if (resp[0] != 'O' || resp[1] != 'K') {
+        fputs("API returned an unexpected error\n", stderr);
+        return -1;
+    }
+
+    return 0;
+}
+
 int create_folder(const char *name, const char *parent_id, char *new_id)
 {
     char req[512], resp[33];
@@ -320,17 +454,21 @@ int create_folder(const char *name, const char *parent_id, char *new_id)
     }
     req[name_len+i] = '\n';
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, name_len+i+1);
     if (r != name_len+i+1) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
     
     r = read(read_fd, resp, 33);
     if (r == -1) {
         perror("read()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
+    pthread_mutex_unlock(&api_lock);
     
     if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -357,17 +495,21 @@ int rename_object(const char *id, const char *new_name, const char is_file)
     memcpy(req+49, new_name, name_len);
     req[name_len+49] = '\n';
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, name_len+50);
     if (r != name_len+50) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
     
     r = read(read_fd, resp, 4);
     if (r == -1) {
         perror("read()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
+    pthread_mutex_unlock(&api_lock);
     
     if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -393,17 +535,21 @@ int delete_object(const char *id, const char is_file)
     memcpy(req+16, id, 32);
     req[48] = '\n';
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, 49);
     if (r != 49) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
 
     r = read(read_fd, resp, 4);
     if (r == -1) {
         perror("read()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
+    pthread_mutex_unlock(&api_lock);
     
     if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -438,17 +584,21 @@ int move_object(const char *id, const char *to_folder_id, const char is_file)
         i = 80;
     }
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, i);
     if (r != i) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
     
     r = read(read_fd, resp, 4);
     if (r == -1) {
         perror("read()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
+    pthread_mutex_unlock(&api_lock);
     
     if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -462,10 +612,10 @@ int move_object(const char *id, const char *to_folder_id, const char is_file)
     return 0;
 }
 
-int upload_file(const c_file *file, const char *to_folder_id, char *new_id)
+int upload_file(const c_file *file, const size_t size, const char *to_folder_id, char *new_id)
 {
     int r, len, i;
-    char req[512], resp[33];
+    char req[BUF_SIZE], resp[33];
     
     memcpy(req, "upload_file", 12);
     if (to_folder_id[0] == 'r') {
@@ -483,20 +633,24 @@ int upload_file(const c_file *file, const char *to_folder_id, char *new_id)
     len = strlen(file->name);
     memcpy(req+i, file->name, len+1);
     i += len+1;
-    snprintf(req+i, 10, "%ld\n", file->size);
+    snprintf(req+i, 10, "%ld\n", size);
     i += strlen(req+i);
     
+    pthread_mutex_lock(&api_lock);
     r = write(write_fd, req, i);
     if (r != i) {
         perror("write()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
     
     r = read(read_fd, resp, 33);
     if (r == -1) {
         perror("read()");
+        pthread_mutex_unlock(&api_lock);
         return -1;
     }
+    pthread_mutex_unlock(&api_lock);
     
     if (resp[0] == 'e' && resp[1] == 'r' && resp[2] == 'r') {
         fputs("API returned an error\n", stderr);
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include "data_structures.h"
 
 #ifndef DGP_API_H
@@ -14,6 +15,8 @@
 #define BUF_SIZE 4096
 #define CHUNK_SIZE 1024
 #define DGP_API_SUBSYSTEM "/usr/local/bin/DigiposteAPI.py"
+//Size of the buffers holding the etag of a document, its terminating null byte included
+#define DGP_ETAG_SIZE 128
 
 typedef struct resp_stuct {
     char *ptr;
@@ -23,6 +26,7 @@ typedef struct resp_stuct {
 
 /*
 Initialize API communication
+Every request below is serialized on a single mutex, so they can be called from any thread
 Return 0 on success, -1 otherwise
 */
 int init_api();
@@ -45,12 +49,39 @@ Return 0 on success, -1 otherwise
 */
 int get_folder_content(c_folder *folder);
 
+/*
+Fetch the content list of the folder of id "id", without touching the tree
+Return the response to be given to add_folder_content(), NULL on error
+*/
+char* fetch_folder_content(const char *id);
+
+/*
+Add the files listed in a response of fetch_folder_content() into folder and mark it loaded
+response is freed, it may be NULL if the fetch failed
+Return 0 on success, -1 otherwise
+*/
+int add_folder_content(c_folder *folder, char *response);
+
 /*
 Download the file at index into folder object to dest_path
 Return 0 on success, -1 otherwise
 */
 int get_file(const c_file *file, const char *dest_path);
 
+/*
+Download the file to dest_path unless etag is not empty and still matches the document on the server
+etag is then replaced by the one of the downloaded content, empty if the server sent none
+Return 0 if the file was downloaded, 1 if dest_path is still up to date, -1 on error
+*/
+int get_file_if(const c_file *file, const char *dest_path, char *etag);
+
+/*
+Download length bytes of the file of id "id" at offset into dest_path, at the same offset
+dest_path is created if needed and the rest of its content is left as is
+Return 0 on success, 1 if the whole file was written because the server ignored the range, -1 otherwise
+*/
+int get_file_range(const char *id, const char *dest_path, const uint64_t offset, const uint64_t length);
+
 /*
 Create a folder named "name" into the folder of id parent_id
 Put the id of the newly created folder into new_id
@@ -81,11 +112,11 @@ Return 0 on success, -1 otherwise
 int move_object(const char *id, const char *to_folder_id, const char is_file);
 
 /*
-Upload the file pointed by "file" to folder id "to_folder_id"
+Upload the cached copy of "file", of size bytes, to folder id "to_folder_id"
 If to_folder_id is NULL, upload to root folder
 Put the id of the newly created file into new_id
 Return 0 on success, -1 otherwise
 */
-int upload_file(const c_file *file, const char *to_folder_id, char *new_id);
+int upload_file(const c_file *file, const size_t size, const char *to_folder_id, char *new_id);
 
 #endif
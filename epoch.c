@@ -0,0 +1,186 @@
+#include "epoch.h"
+
+/*
+A record announces the epoch observed by a reader thread
+state is the epoch shifted left by one, with the low bit set while the thread is in a section
+Records are never freed, the record of an exited thread is reused by the next new thread
+*/
+typedef struct epoch_record {
+    struct epoch_record *next;
+    uint64_t state;
+    char in_use;
+} epoch_record;
+
+typedef struct epoch_item {
+    struct epoch_item *next;
+    uint64_t epoch;
+    void (*release)(void *ptr, void *arg);
+    void *ptr;
+    void *arg;
+} epoch_item;
+
+static uint64_t global_epoch = 0;
+static epoch_record *records = NULL;
+static pthread_mutex_t records_lock = PTHREAD_MUTEX_INITIALIZER;
+static epoch_item *limbo = NULL;
+static pthread_mutex_t limbo_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t record_key;
+static pthread_once_t record_once = PTHREAD_ONCE_INIT;
+
+static void record_put(void *ptr)
+{
+    epoch_record *rec = ptr;
+
+    pthread_mutex_lock(&records_lock);
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+    rec->in_use = 0;
+    pthread_mutex_unlock(&records_lock);
+}
+
+static void record_key_create()
+{
+    if (pthread_key_create(&record_key, record_put) != 0) fputs("pthread_key_create(): error\n", stderr);
+}
+
+static epoch_record* record_get()
+{
+    epoch_record *rec;
+
+    pthread_once(&record_once, record_key_create);
+    rec = pthread_getspecific(record_key);
+    if (rec != NULL) return rec;
+
+    pthread_mutex_lock(&records_lock);
+    for (rec = records; rec != NULL && rec->in_use; rec = rec->next);
+    if (rec == NULL) {
+        rec = malloc(sizeof(epoch_record));
+        if (rec == NULL) {
+            perror("malloc()");
+            pthread_mutex_unlock(&records_lock);
+            return NULL;
+        }
+        rec->state = 0;
+        rec->next = records;
+        records = rec;
+    }
+    rec->in_use = 1;
+    pthread_mutex_unlock(&records_lock);
+
+    pthread_setspecific(record_key, rec);
+
+    return rec;
+}
+
+void epoch_enter()
+{
+    epoch_record *rec;
+    uint64_t epoch;
+
+    rec = record_get();
+    if (rec == NULL) {
+        //Without a record the reader cannot be tracked, keep everything until it is back
+        pthread_mutex_lock(&limbo_lock);
+        return;
+    }
+
+    epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&rec->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit()
+{
+    epoch_record *rec;
+
+    rec = pthread_getspecific(record_key);
+    if (rec == NULL) {
+        pthread_mutex_unlock(&limbo_lock);
+        return;
+    }
+
+    __atomic_store_n(&rec->state, 0, __ATOMIC_RELEASE);
+}
+
+/*
+Move to the next epoch if every active reader has observed the current one
+Called with limbo_lock held
+*/
+static void epoch_advance()
+{
+    epoch_record *rec;
+    uint64_t epoch, state;
+
+    epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&records_lock);
+    for (rec = records; rec != NULL; rec = rec->next) {
+        state = __atomic_load_n(&rec->state, __ATOMIC_ACQUIRE);
+        if ((state & 1) && (state >> 1) != epoch) {
+            pthread_mutex_unlock(&records_lock);
+            return;
+        }
+    }
+    pthread_mutex_unlock(&records_lock);
+
+    __atomic_store_n(&global_epoch, epoch+1, __ATOMIC_RELEASE);
+}
+
+/*
+Release the items retired two epochs ago or earlier
+Called with limbo_lock held
+*/
+static void epoch_reclaim()
+{
+    epoch_item **link, *item;
+    uint64_t epoch;
+
+    epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+
+    link = &limbo;
+    while ((item = *link) != NULL) {
+        if (item->epoch + 2 > epoch) {
+            link = &item->next;
+            continue;
+        }
+        *link = item->next;
+        item->release(item->ptr, item->arg);
+        free(item);
+    }
+}
+
+void epoch_retire(void (*release)(void *ptr, void *arg), void *ptr, void *arg)
+{
+    epoch_item *item;
+
+    item = malloc(sizeof(epoch_item));
+    if (item == NULL) {
+        //Leaking is the only safe way out
+        perror("malloc()");
+        return;
+    }
+    item->release = release;
+    item->ptr = ptr;
+    item->arg = arg;
+
+    pthread_mutex_lock(&limbo_lock);
+    item->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    item->next = limbo;
+    limbo = item;
+
+    epoch_advance();
+    epoch_reclaim();
+    pthread_mutex_unlock(&limbo_lock);
+}
+
+void epoch_flush()
+{
+    epoch_item *item;
+
+    pthread_mutex_lock(&limbo_lock);
+    while ((item = limbo) != NULL) {
+        limbo = item->next;
+        item->release(item->ptr, item->arg);
+        free(item);
+    }
+    pthread_mutex_unlock(&limbo_lock);
+}
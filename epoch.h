@@ -0,0 +1,39 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#ifndef DGP_EPOCH_H
+#define DGP_EPOCH_H
+
+/*
+Epoch-based reclamation
+Readers bracket their lock-free accesses with epoch_enter() and epoch_exit()
+Writers unlink shared memory, then hand it to epoch_retire() instead of releasing it
+Retired memory is released once every reader that could still see it has left its epoch
+*/
+
+/*
+Enter a read-side section for the calling thread
+Sections do not nest
+*/
+void epoch_enter();
+
+/*
+Leave the read-side section of the calling thread
+*/
+void epoch_exit();
+
+/*
+Defer release(ptr, arg) until no reader can see ptr anymore
+Memory retired earlier and now safe is released on the way
+*/
+void epoch_retire(void (*release)(void *ptr, void *arg), void *ptr, void *arg);
+
+/*
+Release all retired memory at once
+No reader may be in a read-side section
+*/
+void epoch_flush();
+
+#endif
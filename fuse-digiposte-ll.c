@@ -0,0 +1,661 @@
+#include "fuse-digiposte.h"
+#include <fuse_lowlevel.h>
+
+/*
+Return the node behind ino and set is_file accordingly
+Return NULL if ino is unknown
+*/
+static void* ll_node(const dgp_ctx *ctx, const fuse_ino_t ino, char *is_file)
+{
+    return find_node_by_ino(ctx->dgp_root->tree, ino, is_file);
+}
+
+static c_folder* ll_folder(const dgp_ctx *ctx, const fuse_ino_t ino, int *err)
+{
+    c_folder *folder;
+    char is_file;
+
+    folder = ll_node(ctx, ino, &is_file);
+    if (folder == NULL) {
+        *err = ENOENT;
+        return NULL;
+    }
+    if (is_file) {
+        *err = ENOTDIR;
+        return NULL;
+    }
+
+    return folder;
+}
+
+static c_file* ll_file(const dgp_ctx *ctx, const fuse_ino_t ino, int *err)
+{
+    c_file *file;
+    char is_file;
+
+    file = ll_node(ctx, ino, &is_file);
+    if (file == NULL) {
+        *err = ENOENT;
+        return NULL;
+    }
+    if (!is_file) {
+        *err = EISDIR;
+        return NULL;
+    }
+
+    return file;
+}
+
+static double ll_ttl(const dgp_ctx *ctx, const char is_file)
+{
+    return is_file ? ctx->opts.file_ttl : ctx->opts.folder_ttl;
+}
+
+static void ll_fill_entry(struct fuse_entry_param *e, const dgp_ctx *ctx, const c_folder *folder, const c_file *file, const struct fuse_ctx *fctx)
+{
+    memset(e, 0, sizeof(struct fuse_entry_param));
+    dgp_fill_stat(&e->attr, folder, file, fctx->uid, fctx->gid);
+    e->ino = e->attr.st_ino;
+    e->generation = 1;
+    e->attr_timeout = ll_ttl(ctx, file != NULL);
+    e->entry_timeout = e->attr_timeout;
+}
+
+/*
+Queued notifications are either an inode whose attributes changed, or a name under a folder inode
+*/
+static void ll_send_invalidation(void *arg, const uint64_t ino, const char *name)
+{
+    struct fuse_session *se = arg;
+
+    if (name == NULL) fuse_lowlevel_notify_inval_inode(se, ino, 0, 0);
+    else fuse_lowlevel_notify_inval_entry(se, ino, name, strlen(name));
+}
+
+/*
+Lookup counts are bumped by concurrent readers of the tree, so they are updated atomically
+*/
+static void ll_ref(uint64_t *nlookup)
+{
+    __atomic_add_fetch(nlookup, 1, __ATOMIC_RELAXED);
+}
+
+static void ll_unref(uint64_t *nlookup, const uint64_t n)
+{
+    uint64_t old, new;
+
+    old = __atomic_load_n(nlookup, __ATOMIC_RELAXED);
+    do new = old > n ? old - n : 0;
+    while (!__atomic_compare_exchange_n(nlookup, &old, new, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/*
+Take the tree lock for reading and return the folder of inode ino with its content loaded
+The lock is held on return, whatever the result
+*/
+static c_folder* ll_lock_folder(dgp_ctx *ctx, const fuse_ino_t ino, int *err)
+{
+    c_folder *folder;
+
+    while (1) {
+        pthread_rwlock_rdlock(&ctx->tree_lock);
+        folder = ll_folder(ctx, ino, err);
+        if (folder == NULL || folder->files_loaded) return folder;
+        pthread_rwlock_unlock(&ctx->tree_lock);
+
+        if (dgp_load_folder(ctx, ino) == -1) {
+            pthread_rwlock_rdlock(&ctx->tree_lock);
+            *err = EIO;
+            return NULL;
+        }
+    }
+}
+
+/*
+Wait for the tree as long as load_timeout, and answer req with an error if it is not loaded by then
+Return 0 if the tree is loaded
+*/
+static int ll_wait_tree(fuse_req_t req, dgp_ctx *ctx)
+{
+    int r;
+
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) fuse_reply_err(req, -r);
+
+    return r;
+}
+
+static void ll_load_error(void *arg)
+{
+    fputs("dgp_load(): error, unmounting\n", stderr);
+    fuse_session_exit((struct fuse_session*)arg);
+}
+
+static void dgp_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+    (void)userdata;
+    dgp_want_splice(conn);
+}
+
+static void dgp_ll_destroy(void *userdata)
+{
+    dgp_ctx *ctx = (dgp_ctx*)userdata;
+
+    dgp_load_join(ctx);
+    snapshot_worker_stop(&ctx->snapshots);
+    //The uploads still queued are run by dgp_unload()
+    writeback_stop(&ctx->uploads);
+    prefetcher_stop(&ctx->prefetch);
+    prefetcher_stop(&ctx->seq_prefetch);
+    dgp_unload(ctx);
+}
+
+static void dgp_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    struct fuse_entry_param e;
+    c_folder *folder;
+    c_file *file;
+    int i, err;
+
+    if (ll_wait_tree(req, ctx) != 0) return;
+
+    while (1) {
+        pthread_rwlock_rdlock(&ctx->tree_lock);
+        folder = ll_folder(ctx, parent, &err);
+        if (folder == NULL) {
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            fuse_reply_err(req, err);
+            return;
+        }
+
+        i = find_folder_name(folder, name);
+        if (i != -1) {
+            ll_fill_entry(&e, ctx, folder->folders[i], NULL, fuse_req_ctx(req));
+            ll_ref(&folder->folders[i]->nlookup);
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            fuse_reply_entry(req, &e);
+            return;
+        }
+        if (folder->files_loaded) break;
+        pthread_rwlock_unlock(&ctx->tree_lock);
+
+        if (dgp_load_folder(ctx, parent) == -1) {
+            fuse_reply_err(req, EIO);
+            return;
+        }
+    }
+
+    i = find_file_name(folder, name);
+    if (i == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        if (ctx->opts.negative_ttl > 0) {
+            //A zero inode makes the kernel cache the absence of the entry
+            memset(&e, 0, sizeof(struct fuse_entry_param));
+            e.entry_timeout = ctx->opts.negative_ttl;
+            fuse_reply_entry(req, &e);
+        }
+        else fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    file = folder->files[i];
+    ll_fill_entry(&e, ctx, folder, file, fuse_req_ctx(req));
+    ll_ref(&file->nlookup);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    fuse_reply_entry(req, &e);
+}
+
+static void ll_forget_one(dgp_ctx *ctx, const fuse_ino_t ino, const uint64_t nlookup)
+{
+    char is_file;
+    void *node;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    node = ll_node(ctx, ino, &is_file);
+    if (node != NULL && is_file) ll_unref(&((c_file*)node)->nlookup, nlookup);
+    else if (node != NULL) ll_unref(&((c_folder*)node)->nlookup, nlookup);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+}
+
+static void dgp_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    ll_forget_one((dgp_ctx*)fuse_req_userdata(req), ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void dgp_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    size_t i;
+
+    for (i=0; i<count; i++) ll_forget_one(ctx, forgets[i].ino, forgets[i].nlookup);
+    fuse_reply_none(req);
+}
+
+static void dgp_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    const struct fuse_ctx *fctx = fuse_req_ctx(req);
+    struct stat st;
+    char is_file;
+    void *node;
+    int r;
+
+    (void)fi;
+
+    //The root is answered at once as an empty folder while the tree is loading
+    r = dgp_wait_tree(ctx, ino == DGP_ROOT_INO ? 0 : ctx->opts.load_timeout);
+    if (r == -EAGAIN && ino == DGP_ROOT_INO) {
+        dgp_fill_stat_root(&st, fctx->uid, fctx->gid);
+        fuse_reply_attr(req, &st, ll_ttl(ctx, 0));
+        return;
+    }
+    if (r != 0) {
+        fuse_reply_err(req, -r);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    node = ll_node(ctx, ino, &is_file);
+    if (node == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    if (is_file) dgp_fill_stat(&st, ((c_file*)node)->parent, node, fctx->uid, fctx->gid);
+    else dgp_fill_stat(&st, node, NULL, fctx->uid, fctx->gid);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    fuse_reply_attr(req, &st, ll_ttl(ctx, is_file));
+}
+
+/*
+Add "." and ".." past off into buf, at offsets 1 and 2 as with the path-based backend
+The kernel takes no lookup reference on them, so they only carry their inode and type
+Return the number of bytes used, full is set if buf could not hold them
+*/
+static size_t ll_add_dots(fuse_req_t req, char *buf, const size_t size, const off_t off,
+                          const uint64_t ino, const uint64_t parent_ino, const char plus, char *full)
+{
+    struct fuse_entry_param e;
+    const char *names[2] = {".", ".."};
+    size_t pos, len;
+    int i;
+
+    memset(&e, 0, sizeof(struct fuse_entry_param));
+    e.attr.st_mode = S_IFDIR;
+
+    pos = 0;
+    *full = 0;
+    for (i = off < 2 ? off : 2; i < 2; i++) {
+        e.attr.st_ino = i == 0 ? ino : parent_ino;
+        if (plus) len = fuse_add_direntry_plus(req, buf+pos, size-pos, names[i], &e, i+1);
+        else len = fuse_add_direntry(req, buf+pos, size-pos, names[i], &e.attr, i+1);
+        if (len > size-pos) {
+            *full = 1;
+            break;
+        }
+        pos += len;
+    }
+
+    return pos;
+}
+
+/*
+Entries are ".", "..", then the child folders followed by the child files, as in the compact folder listing
+The offset of a child is its cookie, a listing resumes past it even if the folder changed meanwhile
+The root is listed empty if the tree is still loading once load_timeout is over
+*/
+static void ll_readdir(fuse_req_t req, const fuse_ino_t ino, const size_t size, const off_t off, const char plus)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    const struct fuse_ctx *fctx = fuse_req_ctx(req);
+    struct fuse_entry_param e;
+    const c_meta *meta;
+    const c_meta_entry *entry;
+    c_folder *folder;
+    char *buf, full;
+    size_t pos, len;
+    int i, err;
+
+    err = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (err == -EAGAIN && ino == DGP_ROOT_INO) {
+        buf = malloc(size);
+        if (buf == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        pos = ll_add_dots(req, buf, size, off, DGP_ROOT_INO, DGP_ROOT_INO, plus, &full);
+        fuse_reply_buf(req, buf, pos);
+        free(buf);
+        return;
+    }
+    if (err != 0) {
+        fuse_reply_err(req, -err);
+        return;
+    }
+
+    folder = ll_lock_folder(ctx, ino, &err);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    meta = get_folder_meta(folder);
+    buf = malloc(size);
+    if (meta == NULL || buf == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        free(buf);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    if (off == 0) dgp_prefetch_children(ctx, meta);
+
+    memset(&e, 0, sizeof(struct fuse_entry_param));
+    e.generation = 1;
+
+    pos = ll_add_dots(req, buf, size, off, folder->ino, meta->parent_ino, plus, &full);
+    for (i = full ? meta->nb_entries : find_meta_cookie(meta, off); i < meta->nb_entries; i++) {
+        entry = &meta->entries[i];
+        dgp_fill_stat_entry(&e.attr, entry, fctx->uid, fctx->gid);
+        e.ino = entry->ino;
+        e.attr_timeout = ll_ttl(ctx, !(entry->flags & META_DIR));
+        e.entry_timeout = e.attr_timeout;
+
+        if (plus) len = fuse_add_direntry_plus(req, buf+pos, size-pos, meta->names + entry->name_off, &e, entry->cookie);
+        else len = fuse_add_direntry(req, buf+pos, size-pos, meta->names + entry->name_off, &e.attr, entry->cookie);
+        if (len > size-pos) break;
+
+        if (plus && entry->flags & META_DIR) ll_ref(&((c_folder*)entry->node)->nlookup);
+        else if (plus) ll_ref(&((c_file*)entry->node)->nlookup);
+        pos += len;
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    fuse_reply_buf(req, buf, pos);
+    free(buf);
+}
+
+static void dgp_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    (void)fi;
+    ll_readdir(req, ino, size, off, 0);
+}
+
+static void dgp_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    (void)fi;
+    ll_readdir(req, ino, size, off, 1);
+}
+
+static void dgp_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    c_file *file;
+    dgp_handle *fh;
+    int fd, err, r;
+
+    if (ll_wait_tree(req, ctx) != 0) return;
+
+    //A background download of the file is waited for without the tree lock, then the file is looked up again
+    while (1) {
+        pthread_rwlock_rdlock(&ctx->tree_lock);
+        file = ll_file(ctx, ino, &err);
+        if (file == NULL) {
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            fuse_reply_err(req, err);
+            return;
+        }
+
+        pthread_mutex_lock(&file->lock);
+        r = dgp_open_cache(ctx, file, fi->flags);
+        if (r != 1) break;
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        dgp_stream_wait(ctx, ino);
+    }
+    if (r == -1) {
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        fuse_reply_err(req, EIO);
+        return;
+    }
+
+    //Opening for writing leaves the file clean, only writes and truncations make it dirty
+    if (fi->flags & O_TRUNC) dgp_file_dirty(ctx, file);
+
+    fd = open(file->cache_path, fi->flags & ~(O_CREAT | O_EXCL | O_NOCTTY));
+    if (fd == -1) {
+        err = errno;
+        perror("open()");
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        fuse_reply_err(req, err);
+        return;
+    }
+    fh = dgp_handle_new(ctx, fd, file);
+    if (fh == NULL) {
+        close(fd);
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    fh->written = (fi->flags & O_TRUNC) != 0;
+    dgp_set_open_cache(ctx, file, fi);
+    pthread_mutex_unlock(&file->lock);
+    dgp_seq_open(ctx, file);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    //Changing the size relinks the listing of the parent, which needs the write lock
+    if (fi->flags & O_TRUNC) {
+        pthread_rwlock_wrlock(&ctx->tree_lock);
+        file = ll_file(ctx, ino, &err);
+        if (file != NULL) set_file_size(file, 0);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        notifier_push(&ctx->notify, ino, NULL);
+    }
+
+    fi->fh = (uintptr_t)fh;
+    fuse_reply_open(req, fi);
+}
+
+static void dgp_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *fi)
+{
+    struct fuse_bufvec src;
+    int r;
+
+    (void)ino;
+
+    r = dgp_read_ready((dgp_ctx*)fuse_req_userdata(req), DGP_HANDLE(fi), off, size);
+    if (r != 0) {
+        fuse_reply_err(req, -r);
+        return;
+    }
+
+    dgp_fd_bufvec(&src, DGP_HANDLE(fi)->fd, size, off);
+    fuse_reply_data(req, &src, FUSE_BUF_SPLICE_MOVE);
+}
+
+static void dgp_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv, off_t off, struct fuse_file_info *fi)
+{
+    struct fuse_bufvec dst;
+    ssize_t r;
+
+    (void)ino;
+
+    //The file is dirty before the copy changes, so that no writer opening meanwhile hashes it as the document
+    //An fsync() may have left the file clean since the last write through this handle
+    dgp_handle_written((dgp_ctx*)fuse_req_userdata(req), DGP_HANDLE(fi));
+
+    dgp_fd_bufvec(&dst, DGP_HANDLE(fi)->fd, fuse_buf_size(bufv), off);
+
+    r = fuse_buf_copy(&dst, bufv, FUSE_BUF_SPLICE_NONBLOCK);
+    if (r < 0) {
+        fprintf(stderr, "fuse_buf_copy(): %s\n", strerror(-r));
+        fuse_reply_err(req, -r);
+        return;
+    }
+
+    fuse_reply_write(req, r);
+}
+
+static void dgp_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    (void)ino;
+    (void)fi;
+    fuse_reply_err(req, 0);
+}
+
+static void dgp_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    c_file *file;
+    int err;
+
+    (void)datasync;
+    (void)fi;
+
+    pthread_rwlock_wrlock(&ctx->tree_lock);
+    file = ll_file(ctx, ino, &err);
+    if (file == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        fuse_reply_err(req, err);
+        return;
+    }
+
+    err = -dgp_internal_fsync(ctx, file->parent, file);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    if (err == 0) notifier_push(&ctx->notify, ino, NULL);
+    fuse_reply_err(req, err);
+}
+
+static void dgp_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+    dgp_ctx *ctx = (dgp_ctx*)fuse_req_userdata(req);
+    c_file *file;
+    int err;
+    char dirty;
+
+    //Handles that changed the copy upload it, an fsync() since may have left the file clean
+    //The last one also uploads changes left over, e.g. by an upload postponed while the file was open
+    dirty = DGP_HANDLE(fi)->written;
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = ll_file(ctx, ino, &err);
+    if (file != NULL) {
+        pthread_mutex_lock(&file->lock);
+        if (dirty) file->dirty = 1;
+        else dirty = file->dirty && file->opens == 1;
+        pthread_mutex_unlock(&file->lock);
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    //With write-back, the upload is queued once the handle no longer holds the file open
+    if (dirty && !ctx->opts.writeback) {
+        pthread_rwlock_wrlock(&ctx->tree_lock);
+        file = ll_file(ctx, ino, &err);
+        if (file != NULL && dgp_internal_fsync(ctx, file->parent, file) == 0) notifier_push(&ctx->notify, ino, NULL);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+    }
+
+    dgp_handle_free(ctx, DGP_HANDLE(fi));
+    if (dirty && ctx->opts.writeback) dgp_writeback_queue(ctx, ino);
+    fuse_reply_err(req, 0);
+}
+
+static const struct fuse_lowlevel_ops dgp_ll_oper = {
+    .init           = dgp_ll_init,
+    .destroy        = dgp_ll_destroy,
+    .lookup         = dgp_ll_lookup,
+    .forget         = dgp_ll_forget,
+    .forget_multi   = dgp_ll_forget_multi,
+    .getattr        = dgp_ll_getattr,
+    .readdir        = dgp_ll_readdir,
+    .readdirplus    = dgp_ll_readdirplus,
+    .open           = dgp_ll_open,
+    .read           = dgp_ll_read,
+    .write_buf      = dgp_ll_write_buf,
+    .flush          = dgp_ll_flush,
+    .fsync          = dgp_ll_fsync,
+    .release        = dgp_ll_release,
+};
+
+int dgp_ll_main(struct fuse_args *args, dgp_ctx *ctx)
+{
+    struct fuse_session *se;
+    struct fuse_cmdline_opts opts;
+    int r;
+
+    if (fuse_parse_cmdline(args, &opts) != 0) {
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (opts.show_help) {
+        printf("usage: %s [options] --lowlevel <mountpoint>\n\n", args->argv[0]);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        free(opts.mountpoint);
+        dgp_ctx_free(ctx);
+        return 0;
+    }
+    if (opts.show_version) {
+        fuse_lowlevel_version();
+        free(opts.mountpoint);
+        dgp_ctx_free(ctx);
+        return 0;
+    }
+    if (opts.mountpoint == NULL) {
+        fprintf(stderr, "usage: %s [options] --lowlevel <mountpoint>\n", args->argv[0]);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+
+    se = fuse_session_new(args, &dgp_ll_oper, sizeof(dgp_ll_oper), ctx);
+    if (se == NULL) {
+        free(opts.mountpoint);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (fuse_set_signal_handlers(se) != 0) {
+        fuse_session_destroy(se);
+        free(opts.mountpoint);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (fuse_session_mount(se, opts.mountpoint) != 0) {
+        fuse_remove_signal_handlers(se);
+        fuse_session_destroy(se);
+        free(opts.mountpoint);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+
+    fuse_daemonize(opts.foreground);
+
+    if (ctx->opts.folder_ttl > 0 || ctx->opts.file_ttl > 0 || ctx->opts.negative_ttl > 0 || ctx->opts.page_cache)
+        notifier_start(&ctx->notify, ll_send_invalidation, se);
+
+    dgp_prefetch_start(ctx);
+    dgp_writeback_start(ctx);
+
+    //The tree is loaded in the background so that the mount does not wait for the API
+    if (dgp_load_start(ctx, ll_load_error, se) == -1) fuse_session_exit(se);
+
+    if (opts.singlethread) r = fuse_session_loop(se);
+    else r = fuse_session_loop_mt(se, opts.clone_fd);
+    notifier_stop(&ctx->notify);
+
+    fuse_session_unmount(se);
+    fuse_remove_signal_handlers(se);
+    fuse_session_destroy(se);
+    //Without an init request, the session ends without calling dgp_ll_destroy()
+    dgp_load_join(ctx);
+    free(opts.mountpoint);
+    dgp_ctx_free(ctx);
+
+    return r;
+}
@@ -1,298 +1,2142 @@
 #include "fuse-digiposte.h"
 
-static int folder_cache_fault(c_folder *folder)
+int folder_cache_fault(c_folder *folder)
 {
     return get_folder_content(folder);
 }
 
-static int file_cache_fault(c_file *file)
+int dgp_load_folder(dgp_ctx *ctx, const uint64_t ino)
 {
-    char dest_path[PATH_MAX];
-    int path_len;
+    c_folder *folder;
+    char is_file;
+    int r = 0;
+
+    pthread_rwlock_wrlock(&ctx->tree_lock);
+    folder = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (folder != NULL && !is_file && !folder->files_loaded) r = folder_cache_fault(folder);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    return r;
+}
+
+/*
+Load the listing of the folder of inode ino, then queue its child folders if depth allows
+The API is called without the tree lock, which is only taken to add the files
+*/
+static void prefetch_folder(void *arg, const uint64_t ino, const int depth)
+{
+    dgp_ctx *ctx = arg;
+    c_folder *folder;
+    char id[32], is_file, loaded;
+    char *response;
+    int i;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    folder = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (folder == NULL || is_file) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return;
+    }
+    memcpy(id, folder->id, 32);
+    loaded = folder->files_loaded;
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    if (!loaded) {
+        response = fetch_folder_content(id);
+        if (response == NULL) return;
+
+        pthread_rwlock_wrlock(&ctx->tree_lock);
+        folder = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+        if (folder != NULL && !is_file && !folder->files_loaded) add_folder_content(folder, response);
+        else free(response);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+    }
+
+    if (depth <= 1) return;
 
-    memcpy(dest_path, CACHE_PATH, sizeof(CACHE_PATH)-1);
-    memcpy(dest_path + sizeof(CACHE_PATH)-1, file->id, 32);
-    dest_path[sizeof(CACHE_PATH)+31] = '\0';
-    path_len = strlen(dest_path);
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    folder = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (folder != NULL && !is_file) {
+        for (i=0; i<folder->nb_folders; i++) {
+            if (!folder->folders[i]->files_loaded) prefetcher_push(&ctx->prefetch, folder->folders[i]->ino, depth-1);
+        }
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+}
+
+void dgp_prefetch_children(dgp_ctx *ctx, const c_meta *meta)
+{
+    int i;
+
+    if (ctx->opts.prefetch_depth <= 0) return;
+
+    for (i=0; i<meta->nb_folders; i++) prefetcher_push(&ctx->prefetch, meta->entries[i].ino, ctx->opts.prefetch_depth);
+}
+
+/*
+Set the cache_path of file from its id if it has none yet
+Return 0 on success, -1 otherwise
+*/
+static int set_cache_path(const dgp_ctx *ctx, c_file *file)
+{
+    size_t dir_len;
 
-    if (get_file(file, dest_path) == -1) return -1;
+    if (file->cache_path != NULL) return 0;
 
-    file->cache_path = malloc(path_len+1);
+    dir_len = strlen(ctx->cache_dir);
+    file->cache_path = malloc(dir_len+33);
     if (file->cache_path == NULL) {
         perror("malloc()");
         return -1;
     }
-
-    strcpy(file->cache_path, dest_path);
-    file->cached = 1;
+    memcpy(file->cache_path, ctx->cache_dir, dir_len);
+    memcpy(file->cache_path + dir_len, file->id, 32);
+    file->cache_path[dir_len+32] = '\0';
 
     return 0;
 }
 
-static void generate_new_id(char *id)
+static size_t nb_blocks(const c_file *file, const size_t block_size)
 {
-    static int counter = 0;
-    sprintf(id, "new-%028d", counter);
-    counter++;
+    return (file->size + block_size-1) / block_size;
 }
 
-static int get_subpath(const char *path, char *subpath, char *name)
+static char block_present(const c_file *file, const size_t block)
 {
-    int i, j, k, path_len;
+    return file->blocks[block/8] & (1 << (block%8));
+}
 
-    path_len = strlen(path);
-    i = path_len-1;
-    while (path[i] != '/') i--;
-    for (j=0; j<i; j++) subpath[j] = path[j];
-    if (j==0) {
-        subpath[j] = '/';
-        subpath[j+1] = '\0';
+static void set_block_present(c_file *file, const size_t block)
+{
+    if (block_present(file, block)) return;
+    file->blocks[block/8] |= 1 << (block%8);
+    file->blocks_missing--;
+}
+
+/*
+Forget the blocks of file, its cached copy is complete
+The copy is hashed again by the next writer, see dgp_open_cache()
+*/
+static void set_file_complete(c_file *file)
+{
+    free(file->blocks);
+    file->blocks = NULL;
+    file->blocks_missing = 0;
+    file->cached = 1;
+    file->hashed = 0;
+}
+
+int file_cache_fault(dgp_ctx *ctx, c_file *file)
+{
+    char etag[DGP_ETAG_SIZE];
+
+    if (set_cache_path(ctx, file) == -1) return -1;
+
+    //A persistent copy is recorded with the etag of its content, to be revalidated by the next mounts
+    if (ctx->opts.cache_dir != NULL && file->id[0] != 'n') {
+        etag[0] = '\0';
+        if (get_file_if(file, file->cache_path, etag) == -1) return -1;
+        manifest_set(&ctx->cache_manifest, file->id, file->size, etag);
     }
-    else subpath[j] = '\0';
-    for (k=i+1; k<=path_len; k++) name[k-(i+1)] = path[k];
+    else if (get_file(file, file->cache_path) == -1) return -1;
 
-    return strlen(name);
+    set_file_complete(file);
+    file->pages_valid = 0;
+
+    return 0;
 }
 
 /*
-If path point to a directory, return the directory and set index to -1
-If path point to a file, return the containing directory and set index to the index of the file in files table
-If path doesn't exist or error occured, return NULL
+Create the cached copy of file as a sparse file of its size, with no block present
+Return 0 on success, -1 otherwise
 */
-static c_folder* resolve_path(const char *path, int *index, const dgp_ctx *ctx)
+static int file_sparse_fault(dgp_ctx *ctx, c_file *file)
 {
-    int path_len, path_i, subpath_i, i;
-    char type = -1;
-    char subpath[PATH_MAX];
-    c_folder *current_folder;
+    const size_t block_size = ctx->opts.block_size;
+    int fd;
 
-    current_folder = ctx->dgp_root;
-    *index = -1;
+    if (set_cache_path(ctx, file) == -1) return -1;
 
-    path_len = strlen(path);
-    if (path_len == 1 && path[0] == '/') {
-        *index = -1;
-        return current_folder;
+    fd = open(file->cache_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        perror("open()");
+        return -1;
+    }
+    if (ftruncate(fd, file->size) == -1) {
+        perror("ftruncate()");
+        close(fd);
+        return -1;
     }
+    close(fd);
 
-    path_i = 1;
-    do {
-        subpath_i = 0;
-        while (path_i < path_len && path[path_i] != '/') {
-            subpath[subpath_i] = path[path_i];
-            path_i++;
-            subpath_i++;
+    file->pages_valid = 0;
+    if (file->size == 0) {
+        set_file_complete(file);
+        return 0;
+    }
+
+    file->blocks = calloc((nb_blocks(file, block_size)+7) / 8, 1);
+    if (file->blocks == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+    file->blocks_missing = nb_blocks(file, block_size);
+
+    return 0;
+}
+
+/*
+Fetch the blocks of file covering size bytes at off that are not present yet
+Consecutive missing blocks are fetched with a single range request
+Return 0 on success, -1 otherwise
+*/
+static int file_block_fault(c_file *file, const off_t off, size_t size, const size_t block_size)
+{
+    size_t first, last, end, i;
+    uint64_t start, stop;
+    int r;
+
+    if (file->blocks == NULL || size == 0 || (size_t)off >= file->size) return 0;
+    if (off + size > file->size) size = file->size - off;
+
+    first = off / block_size;
+    last = (off + size-1) / block_size;
+    i = first;
+    while (i <= last) {
+        if (block_present(file, i)) {
+            i++;
+            continue;
         }
-        subpath[subpath_i] = '\0';
-        if (path_i < path_len) {
-            i = find_folder_name(current_folder, subpath);
-            if (i == -1) return NULL;
-            current_folder = current_folder->folders[i];
+        end = i;
+        while (end < last && !block_present(file, end+1)) end++;
+
+        start = (uint64_t)i * block_size;
+        stop = (uint64_t)(end+1) * block_size;
+        if (stop > file->size) stop = file->size;
+
+        r = get_file_range(file->id, file->cache_path, start, stop - start);
+        if (r == -1) return -1;
+        if (r == 1) {
+            set_file_complete(file);
+            return 0;
         }
-        else {
-            i = find_folder_name(current_folder, subpath);
-            if (i != -1) {
-                *index = -1;
-                return current_folder->folders[i];
-            }
-            else {
-                if (!current_folder->files_loaded && folder_cache_fault(current_folder) == -1) return NULL;
-                i = find_file_name(current_folder, subpath);
-                if (i == -1) return NULL;
-                *index = i;
-                return current_folder;
-            }
+        for (; i<=end; i++) set_block_present(file, i);
+    }
+
+    if (file->blocks_missing == 0) set_file_complete(file);
+
+    return 0;
+}
+
+//Size of the first range requested by a background download, doubled for each next one up to STREAM_MAX_CHUNK
+#define STREAM_FIRST_CHUNK (256 * 1024)
+#define STREAM_MAX_CHUNK (8 * 1024 * 1024)
+
+typedef struct stream_job {
+    dgp_ctx *ctx;
+    uint64_t ino;
+    char id[32];
+    char *cache_path;
+    uint64_t size;
+} stream_job;
+
+/*
+Record that the first landed bytes of the document downloaded by job are written, done is set once the download ended
+The file is looked up again by inode, it may have been removed or replaced meanwhile
+Return 0 if the download goes on, -1 if the file is gone
+*/
+static int stream_update(stream_job *job, const uint64_t landed, const char done, const char complete)
+{
+    c_file *file;
+    char is_file;
+    int r = 0;
+
+    pthread_rwlock_rdlock(&job->ctx->tree_lock);
+    file = find_node_by_ino(job->ctx->dgp_root->tree, job->ino, &is_file);
+    if (file == NULL || !is_file || memcmp(file->id, job->id, 32) != 0) {
+        pthread_rwlock_unlock(&job->ctx->tree_lock);
+        return -1;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    if (!file->streaming) r = -1;
+    else {
+        file->landed = landed;
+        if (done) {
+            if (complete) set_file_complete(file);
+            file->streaming = 0;
         }
-        path_i++;
-    } while (path_i < path_len);
+        pthread_cond_broadcast(&file->landed_cond);
+    }
+    pthread_mutex_unlock(&file->lock);
+    pthread_rwlock_unlock(&job->ctx->tree_lock);
+
+    return r;
+}
+
+/*
+Download thread of a cached copy
+The document is fetched by growing range requests, so that other API calls and tree writers get in between
+*/
+static void* stream_run(void *arg)
+{
+    stream_job *job = arg;
+    dgp_ctx *ctx = job->ctx;
+    uint64_t landed, chunk, length;
+    char stop;
+    int r = 0;
+
+    landed = 0;
+    chunk = STREAM_FIRST_CHUNK;
+    while (landed < job->size) {
+        pthread_mutex_lock(&ctx->stream_lock);
+        stop = ctx->streams_stop;
+        pthread_mutex_unlock(&ctx->stream_lock);
+        if (stop) {
+            r = -1;
+            break;
+        }
+
+        length = job->size - landed < chunk ? job->size - landed : chunk;
+        r = get_file_range(job->id, job->cache_path, landed, length);
+        if (r == -1) break;
+        landed = r == 1 ? job->size : landed + length;
+        if (landed < job->size && stream_update(job, landed, 0, 0) == -1) break;
+        if (chunk < STREAM_MAX_CHUNK) chunk *= 2;
+    }
+
+    stream_update(job, landed, 1, landed == job->size && r != -1);
+
+    free(job->cache_path);
+    free(job);
+
+    pthread_mutex_lock(&ctx->stream_lock);
+    ctx->streams--;
+    pthread_cond_broadcast(&ctx->stream_cond);
+    pthread_mutex_unlock(&ctx->stream_lock);
 
     return NULL;
 }
 
-static void *dgp_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+/*
+Create the cached copy of file empty and start downloading it in the background
+Must be called with the tree lock held for reading and the lock of file
+Return 0 on success, -1 otherwise
+*/
+static int file_stream_fault(dgp_ctx *ctx, c_file *file)
 {
-    dgp_ctx *ctx;
+    pthread_t thread;
+    stream_job *job;
+    int fd, r;
+
+    if (set_cache_path(ctx, file) == -1) return -1;
+
+    fd = open(file->cache_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        perror("open()");
+        return -1;
+    }
+    close(fd);
+
+    job = malloc(sizeof(stream_job));
+    if (job == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+    job->cache_path = strdup(file->cache_path);
+    if (job->cache_path == NULL) {
+        perror("strdup()");
+        free(job);
+        return -1;
+    }
+    job->ctx = ctx;
+    job->ino = file->ino;
+    memcpy(job->id, file->id, 32);
+    job->size = file->size;
+
+    //The thread needs the lock of file to land its bytes, held by the caller until the download is set up
+    file->landed = 0;
+    file->pages_valid = 0;
+    file->streaming = 1;
+
+    //No download starts while the tree is being unloaded
+    pthread_mutex_lock(&ctx->stream_lock);
+    r = ctx->streams_stop ? -1 : 0;
+    if (r == 0 && pthread_create(&thread, NULL, stream_run, job) != 0) {
+        fputs("pthread_create(): error\n", stderr);
+        r = -1;
+    }
+    if (r == 0) ctx->streams++;
+    pthread_mutex_unlock(&ctx->stream_lock);
+
+    if (r == -1) {
+        file->streaming = 0;
+        free(job->cache_path);
+        free(job);
+        return -1;
+    }
+    pthread_detach(thread);
+
+    return 0;
+}
+
+int dgp_stream_wait(dgp_ctx *ctx, const uint64_t ino)
+{
+    c_file *file;
+    char is_file, streaming;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (file == NULL || !is_file) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return 0;
+    }
+
+    //A download signals its end under stream_lock, taken before the lock of file is released so that it is not missed
+    pthread_mutex_lock(&file->lock);
+    streaming = file->streaming;
+    if (streaming) pthread_mutex_lock(&ctx->stream_lock);
+    pthread_mutex_unlock(&file->lock);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    if (!streaming) return 0;
+    pthread_cond_wait(&ctx->stream_cond, &ctx->stream_lock);
+    pthread_mutex_unlock(&ctx->stream_lock);
+
+    return 1;
+}
+
+/*
+Wait until the bytes of file covering size bytes at off have been downloaded
+Return 0 on success, -1 if the download failed before
+*/
+static int file_wait_landed(c_file *file, const off_t off, const size_t size)
+{
+    uint64_t need;
+
+    need = off + size;
+    if (need > file->size) need = file->size;
+
+    while (file->streaming && file->landed < need) pthread_cond_wait(&file->landed_cond, &file->lock);
+    if (!file->cached && file->landed < need) return -1;
+
+    return 0;
+}
+
+/*
+Reuse the cached copy of file left by a former mount, if the manifest has it with the size of the document
+A copy recorded with an etag is revalidated by a conditional request, which downloads the document again if it changed
+Must be called with the tree lock held and the lock of file
+Return 0 if the cached copy is complete, -1 if it must be fetched
+*/
+static int file_reuse_fault(dgp_ctx *ctx, c_file *file)
+{
+    char etag[DGP_ETAG_SIZE];
     struct stat st;
+    size_t size;
+    int r;
 
-    cfg->use_ino = 0;
-    cfg->direct_io = 1;
-    //cfg->parallel_direct_writes = 1;
-    cfg->entry_timeout = 0;
-    cfg->attr_timeout = 0;
-    cfg->negative_timeout = 0;
+    //Claiming the copy keeps it from being evicted as an idle one meanwhile
+    if (file->id[0] == 'n' || manifest_claim(&ctx->cache_manifest, file->id, &size, etag) == -1) return -1;
+    if (set_cache_path(ctx, file) == -1) return -1;
 
-    ctx = fuse_get_context()->private_data;
+    if (size != file->size || stat(file->cache_path, &st) == -1 || (size_t)st.st_size != size) {
+        manifest_remove(&ctx->cache_manifest, file->id);
+        return -1;
+    }
 
-    if (init_api() == -1) {
-        free(ctx);
-        fputs("init_api(): error\n", stderr);
-        exit(-1);
+    if (etag[0] != '\0') {
+        r = get_file_if(file, file->cache_path, etag);
+        if (r == -1) {
+            manifest_remove(&ctx->cache_manifest, file->id);
+            return -1;
+        }
+        if (r == 0) manifest_set(&ctx->cache_manifest, file->id, file->size, etag);
     }
 
-    ctx->dgp_root = get_folders();
-    if (ctx->dgp_root == NULL) {
-        free(ctx);
-        fputs("get_folders(): error\n", stderr);
-        exit(-1);
+    set_file_complete(file);
+    file->pages_valid = 0;
+
+    return 0;
+}
+
+int dgp_open_cache(dgp_ctx *ctx, c_file *file, const int flags)
+{
+    char read_only;
+
+    read_only = (flags & O_ACCMODE) == O_RDONLY && !(flags & O_TRUNC);
+
+    //Writers need the whole file, the caller waits for a download in progress to end without the tree lock
+    if (!read_only && file->streaming) return 1;
+
+    if (!file->cached && file->blocks == NULL && !file->streaming && ctx->opts.cache_dir != NULL)
+        file_reuse_fault(ctx, file);
+
+    if (!file->cached) {
+        if (read_only && (file->blocks != NULL || file->streaming)) return 0;
+        if (read_only && ctx->opts.block_cache) return file_sparse_fault(ctx, file);
+        if (read_only && !ctx->opts.sync_download) return file_stream_fault(ctx, file);
+
+        if (file_cache_fault(ctx, file) == -1) {
+            //A failed download may have truncated the sparse copy, which is then started over
+            if (file->blocks != NULL) {
+                free(file->blocks);
+                file->blocks = NULL;
+                file_sparse_fault(ctx, file);
+            }
+            return -1;
+        }
     }
 
-    ctx->root_loaded = 1;
+    //A clean copy still holds the content of the document, which the upload compares against
+    if (!read_only && !file->dirty && !file->hashed && file->id[0] != 'n')
+        file->hashed = content_hash(file->cache_path, &file->hash) == 0;
 
-    if (stat(CACHE_PATH, &st) == -1) {
-        if (mkdir(CACHE_PATH, 0770) != 0) {
-            perror("mkdir()");
-            exit(-errno);
+    return 0;
+}
+
+/*
+Drop the least recently used cached copies until the cache is within its bounds again, keep aside
+Must be called with the tree lock held
+*/
+static void cache_evict(dgp_ctx *ctx, const c_file *keep)
+{
+    c_file *file;
+    char id[32], path[PATH_MAX];
+    uint64_t bytes;
+    size_t dir_len;
+    int files;
+
+    //Copies left by former mounts and not used since are the least recently used of all, they go first
+    if (ctx->opts.cache_dir != NULL) {
+        dir_len = strlen(ctx->cache_dir);
+        while (1) {
+            manifest_idle(&ctx->cache_manifest, &bytes, &files);
+            cache_lru_set_idle(&ctx->lru, bytes, files);
+            if (files == 0 || !cache_lru_over_bounds(&ctx->lru) || manifest_pop_idle(&ctx->cache_manifest, id) == -1) break;
+            if (dir_len + 32 >= PATH_MAX) continue;
+            memcpy(path, ctx->cache_dir, dir_len);
+            memcpy(path+dir_len, id, 32);
+            path[dir_len+32] = '\0';
+            if (unlink(path) == -1 && errno != ENOENT) perror("unlink()");
         }
     }
 
-    return (void*)ctx;
+    while ((file = cache_lru_victim(&ctx->lru, keep)) != NULL) {
+        if (file->cache_path != NULL && unlink(file->cache_path) == -1 && errno != ENOENT) perror("unlink()");
+        if (ctx->opts.cache_dir != NULL) manifest_remove(&ctx->cache_manifest, file->id);
+        free(file->cache_path);
+        file->cache_path = NULL;
+        free(file->blocks);
+        file->blocks = NULL;
+        file->blocks_missing = 0;
+        file->cached = 0;
+        file->pages_valid = 0;
+        pthread_mutex_unlock(&file->lock);
+    }
+}
+
+/*
+Count the cached copy of file as the most recently used one, then evict others if the cache went over its bounds
+Must be called with the tree lock held and the lock of file
+*/
+static void cache_admit(dgp_ctx *ctx, c_file *file)
+{
+    cache_lru_touch(&ctx->lru, file);
+    cache_evict(ctx, file);
+}
+
+/*
+Download the file of inode ino in the background, unless the run of opens of generation gen it was queued for broke since
+Each thread waits for its download to end before taking the next file, which bounds how many run at once
+The tree lock is not held meanwhile, so that writers get in
+*/
+static void seq_prefetch_file(void *arg, const uint64_t ino, const int gen)
+{
+    dgp_ctx *ctx = arg;
+    c_file *file;
+    char is_file, current, started;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (file == NULL || !is_file) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return;
+    }
+
+    pthread_mutex_lock(&ctx->seq_lock);
+    current = file->parent->seq_gen == gen;
+    pthread_mutex_unlock(&ctx->seq_lock);
+
+    pthread_mutex_lock(&file->lock);
+    started = current && !file->cached && !file->streaming && file->blocks == NULL && file_stream_fault(ctx, file) == 0;
+    if (started) cache_admit(ctx, file);
+    pthread_mutex_unlock(&file->lock);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    if (started) while (dgp_stream_wait(ctx, ino));
+}
+
+void dgp_seq_open(dgp_ctx *ctx, const c_file *file)
+{
+    c_folder *folder = file->parent;
+    unsigned long bytes;
+    int i, index, gen, run;
+
+    if (ctx->opts.seq_prefetch_files <= 0) return;
+
+    index = file->parent_index;
+    pthread_mutex_lock(&ctx->seq_lock);
+    if (index == folder->seq_last + 1) folder->seq_run++;
+    else if (index != folder->seq_last) {
+        //The files still queued for the former run are skipped
+        folder->seq_run = 1;
+        folder->seq_gen++;
+    }
+    folder->seq_last = index;
+    run = folder->seq_run;
+    gen = folder->seq_gen;
+    pthread_mutex_unlock(&ctx->seq_lock);
+
+    if (run < 2) return;
+
+    bytes = 0;
+    for (i=index+1; i<folder->nb_files && i<=index+ctx->opts.seq_prefetch_files; i++) {
+        bytes += folder->files[i]->size;
+        if (bytes > ctx->opts.seq_prefetch_bytes) break;
+        prefetcher_push(&ctx->seq_prefetch, folder->files[i]->ino, gen);
+    }
+}
+
+int dgp_prefetch_start(dgp_ctx *ctx)
+{
+    int r = 0;
+
+    if (ctx->opts.prefetch_depth > 0 && prefetcher_start(&ctx->prefetch, ctx->opts.prefetch_threads, prefetch_folder, ctx) == -1)
+        r = -1;
+    if (ctx->opts.seq_prefetch_files > 0 && prefetcher_start(&ctx->seq_prefetch, ctx->opts.prefetch_threads, seq_prefetch_file, ctx) == -1)
+        r = -1;
+
+    return r;
+}
+
+dgp_handle* dgp_handle_new(dgp_ctx *ctx, const int fd, c_file *file)
+{
+    dgp_handle *fh;
+
+    fh = malloc(sizeof(dgp_handle));
+    if (fh == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+    fh->fd = fd;
+    fh->ino = file->ino;
+    fh->partial = file->blocks != NULL || file->streaming;
+    fh->written = 0;
+
+    file->opens++;
+    cache_admit(ctx, file);
+
+    return fh;
+}
+
+void dgp_handle_free(dgp_ctx *ctx, dgp_handle *fh)
+{
+    c_file *file;
+    char is_file;
+
+    close(fh->fd);
+
+    //The copy may have grown meanwhile, it is charged again and may now be evicted
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, fh->ino, &is_file);
+    if (file != NULL && is_file) {
+        pthread_mutex_lock(&file->lock);
+        if (file->opens > 0) file->opens--;
+        if (file->cache_path != NULL) cache_lru_touch(&ctx->lru, file);
+        pthread_mutex_unlock(&file->lock);
+        cache_evict(ctx, NULL);
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    free(fh);
+}
+
+void dgp_file_dirty(dgp_ctx *ctx, c_file *file)
+{
+    file->dirty = 1;
+    //The copy differs from the document until it is uploaded, or found back to its content
+    if (ctx->opts.cache_dir != NULL) manifest_suspend(&ctx->cache_manifest, file->id);
+}
+
+void dgp_handle_written(dgp_ctx *ctx, dgp_handle *fh)
+{
+    c_file *file;
+    char is_file;
+
+    fh->written = 1;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, fh->ino, &is_file);
+    if (file != NULL && is_file) {
+        pthread_mutex_lock(&file->lock);
+        if (!file->dirty) dgp_file_dirty(ctx, file);
+        pthread_mutex_unlock(&file->lock);
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+}
+
+int dgp_read_ready(dgp_ctx *ctx, dgp_handle *fh, const off_t off, const size_t size)
+{
+    c_file *file;
+    char is_file;
+    int r = 0;
+
+    if (!__atomic_load_n(&fh->partial, __ATOMIC_RELAXED)) return 0;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, fh->ino, &is_file);
+    if (file != NULL && is_file) {
+        pthread_mutex_lock(&file->lock);
+        if (file->blocks != NULL) r = file_block_fault(file, off, size, ctx->opts.block_size);
+        else r = file_wait_landed(file, off, size);
+        if (file->cached) __atomic_store_n(&fh->partial, 0, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&file->lock);
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    return r == -1 ? -EIO : 0;
+}
+
+void dgp_set_open_cache(const dgp_ctx *ctx, c_file *file, struct fuse_file_info *fi)
+{
+    if (!ctx->opts.page_cache) {
+        fi->direct_io = 1;
+        return;
+    }
+
+    //Without keep_cache the kernel drops the pages of the inode on open, so they match the cached copy afterwards
+    fi->direct_io = 0;
+    fi->keep_cache = file->pages_valid;
+    file->pages_valid = 1;
+}
+
+void dgp_want_splice(struct fuse_conn_info *conn)
+{
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE);
+}
+
+void dgp_fd_bufvec(struct fuse_bufvec *bufv, const int fd, const size_t size, const off_t off)
+{
+    *bufv = (struct fuse_bufvec)FUSE_BUFVEC_INIT(size);
+    bufv->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    bufv->buf[0].fd = fd;
+    bufv->buf[0].pos = off;
+}
+
+static void generate_new_id(char *id)
+{
+    static int counter = 0;
+    sprintf(id, "new-%028d", counter);
+    counter++;
+}
+
+static int get_subpath(const char *path, char *subpath, char *name)
+{
+    int i, j, k, path_len;
+
+    path_len = strlen(path);
+    i = path_len-1;
+    while (path[i] != '/') i--;
+    for (j=0; j<i; j++) subpath[j] = path[j];
+    if (j==0) {
+        subpath[j] = '/';
+        subpath[j+1] = '\0';
+    }
+    else subpath[j] = '\0';
+    for (k=i+1; k<=path_len; k++) name[k-(i+1)] = path[k];
+
+    return strlen(name);
+}
+
+/*
+Walk the tree from the root, component by component
+Same contract as resolve_path()
+*/
+static c_folder* walk_path(const char *path, int *index, const dgp_ctx *ctx, c_folder **unloaded)
+{
+    int path_len, path_i, subpath_i, i;
+    char type = -1;
+    char subpath[PATH_MAX];
+    c_folder *current_folder;
+
+    current_folder = ctx->dgp_root;
+    *index = -1;
+
+    path_len = strlen(path);
+    if (path_len == 1 && path[0] == '/') {
+        *index = -1;
+        return current_folder;
+    }
+
+    path_i = 1;
+    do {
+        subpath_i = 0;
+        while (path_i < path_len && path[path_i] != '/') {
+            subpath[subpath_i] = path[path_i];
+            path_i++;
+            subpath_i++;
+        }
+        subpath[subpath_i] = '\0';
+        if (path_i < path_len) {
+            i = find_folder_name(current_folder, subpath);
+            if (i == -1) return NULL;
+            current_folder = current_folder->folders[i];
+        }
+        else {
+            i = find_folder_name(current_folder, subpath);
+            if (i != -1) {
+                *index = -1;
+                return current_folder->folders[i];
+            }
+            else {
+                if (!current_folder->files_loaded && unloaded != NULL) {
+                    *unloaded = current_folder;
+                    return NULL;
+                }
+                if (!current_folder->files_loaded && folder_cache_fault(current_folder) == -1) return NULL;
+                i = find_file_name(current_folder, subpath);
+                if (i == -1) return NULL;
+                *index = i;
+                return current_folder;
+            }
+        }
+        path_i++;
+    } while (path_i < path_len);
+
+    return NULL;
+}
+
+/*
+If path point to a directory, return the directory and set index to -1
+If path point to a file, return the containing directory and set index to the index of the file in files table
+If path doesn't exist or error occured, return NULL
+If a folder on the way has to be loaded and unloaded is not NULL, set it to that folder and return NULL
+Otherwise the folder is loaded in place, which needs the tree lock held for writing
+*/
+static c_folder* resolve_path(const char *path, int *index, dgp_ctx *ctx, c_folder **unloaded)
+{
+    c_folder *folder;
+    c_file *file;
+
+    if (path_cache_lookup(&ctx->paths, path, &folder, &file) == 0) {
+        if (file == NULL) {
+            *index = -1;
+            return folder;
+        }
+        *index = file->parent_index;
+        return file->parent;
+    }
+
+    folder = walk_path(path, index, ctx, unloaded);
+    if (folder == NULL) return NULL;
+
+    if (*index == -1) path_cache_insert(&ctx->paths, path, folder, NULL);
+    else path_cache_insert(&ctx->paths, path, folder, folder->files[*index]);
+
+    return folder;
+}
+
+/*
+Take the tree lock, for writing if exclusive is set, and resolve path under it
+If content is set and path is a folder, its content is loaded as well
+With the read lock, a folder to load is loaded by dgp_load_folder() and the lookup is retried
+The lock is held on return, whatever the result
+*/
+static c_folder* lock_path(const char *path, int *index, dgp_ctx *ctx, const char exclusive, const char content)
+{
+    c_folder *folder, *unloaded;
+    uint64_t ino;
+
+    if (exclusive) {
+        pthread_rwlock_wrlock(&ctx->tree_lock);
+        folder = resolve_path(path, index, ctx, NULL);
+        if (folder != NULL && *index == -1 && content && !folder->files_loaded && folder_cache_fault(folder) == -1)
+            return NULL;
+        return folder;
+    }
+
+    while (1) {
+        pthread_rwlock_rdlock(&ctx->tree_lock);
+        unloaded = NULL;
+        folder = resolve_path(path, index, ctx, &unloaded);
+        if (folder != NULL && *index == -1 && content && !folder->files_loaded) unloaded = folder;
+        if (unloaded == NULL) return folder;
+        ino = unloaded->ino;
+        pthread_rwlock_unlock(&ctx->tree_lock);
+
+        if (dgp_load_folder(ctx, ino) == -1) {
+            pthread_rwlock_rdlock(&ctx->tree_lock);
+            return NULL;
+        }
+    }
+}
+
+/*
+Lock-free lookup of path through the published folder listings, to be called within an epoch
+On success, set entry to the listing entry of path and folder to the folder path points to, or to the parent of the file
+For the root, entry is set to NULL
+Return 0 on success, -ENOENT if path doesn't exist
+Return -EAGAIN if a listing on the way is not published, the lookup has to take the tree lock then
+*/
+static int lookup_path_fast(const char *path, const dgp_ctx *ctx, const c_folder **folder, const c_meta_entry **entry)
+{
+    const c_folder *current;
+    const c_meta *meta;
+    const c_meta_entry *e;
+    char name[PATH_MAX];
+    int path_len, path_i, name_i;
+
+    current = ctx->dgp_root;
+    *folder = current;
+    *entry = NULL;
+
+    path_len = strlen(path);
+    path_i = 1;
+    while (path_i < path_len) {
+        name_i = 0;
+        while (path_i < path_len && path[path_i] != '/') name[name_i++] = path[path_i++];
+        name[name_i] = '\0';
+        path_i++;
+
+        meta = peek_folder_meta(current);
+        if (meta == NULL) return -EAGAIN;
+
+        e = find_meta_entry(meta, name);
+        if (e == NULL && path_i < path_len) return -ENOENT;
+        if (e == NULL) return meta->files_loaded ? -ENOENT : -EAGAIN;
+
+        if (path_i >= path_len) {
+            *entry = e;
+            *folder = e->flags & META_DIR ? e->node : current;
+            return 0;
+        }
+        if (!(e->flags & META_DIR)) return -ENOENT;
+        current = e->node;
+    }
+
+    return 0;
+}
+
+/*
+Fill stbuf for folder from its listing
+*/
+static void fill_stat_meta(struct stat *stbuf, const uint64_t ino, const c_meta *meta, const uid_t uid, const gid_t gid)
+{
+    c_meta_entry entry;
+
+    memset(&entry, 0, sizeof(c_meta_entry));
+    entry.ino = ino;
+    entry.nlink = 2 + meta->nb_folders;
+    entry.flags = META_DIR;
+    dgp_fill_stat_entry(stbuf, &entry, uid, gid);
+}
+
+/*
+Fill entry for file, with a copy of its name
+The copy keeps the name of the former id when an upload fails after the document was deleted, so it is taken from cache_path
+Must be called for a file with a cached copy
+Return 0 on success, -1 otherwise
+*/
+static int journal_fill(journal_entry *entry, const c_file *file)
+{
+    size_t len;
+
+    len = strlen(file->name);
+    entry->name = malloc(len+1);
+    if (entry->name == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+    memcpy(entry->name, file->name, len+1);
+    memcpy(entry->id, file->cache_path + strlen(file->cache_path) - 32, 32);
+    memcpy(entry->folder_id, file->parent->id, 32);
+
+    return 0;
+}
+
+/*
+Write the journal with the files queued for write-back that still have changes to upload
+Must be called with the tree lock held
+*/
+static void journal_write(dgp_ctx *ctx)
+{
+    journal_entry *entries;
+    uint64_t *inos;
+    c_file *file;
+    char is_file;
+    int i, n, nb;
+
+    pthread_mutex_lock(&ctx->journal_lock);
+    n = writeback_pending(&ctx->uploads, &inos);
+    if (n == -1) {
+        pthread_mutex_unlock(&ctx->journal_lock);
+        return;
+    }
+    entries = malloc((n > 0 ? n : 1) * sizeof(journal_entry));
+    if (entries == NULL) {
+        perror("malloc()");
+        pthread_mutex_unlock(&ctx->journal_lock);
+        free(inos);
+        return;
+    }
+
+    nb = 0;
+    for (i=0; i<n; i++) {
+        file = find_node_by_ino(ctx->dgp_root->tree, inos[i], &is_file);
+        if (file != NULL && is_file && file->cached && file->dirty && journal_fill(&entries[nb], file) == 0) nb++;
+    }
+    if (journal_save(ctx->journal_path, entries, nb) == -1) fputs("journal_save(): error\n", stderr);
+    pthread_mutex_unlock(&ctx->journal_lock);
+
+    journal_free(entries, nb);
+    free(inos);
+}
+
+/*
+Find the file of a journal entry, or add it back to its folder, and mark its cached copy to be uploaded again
+A document deleted by an interrupted upload, or already replaced under a new id, is found by its name
+Files added back get a new id that no copy uses, since each mount hands out the same ones
+Must be called with the tree lock held for writing
+Return the file, NULL if its copy or its folder is gone
+*/
+static c_file* journal_recover_entry(dgp_ctx *ctx, const journal_entry *entry)
+{
+    char copy_path[PATH_MAX], id[33];
+    c_folder *folder;
+    c_file *file;
+    struct stat st;
+    size_t dir_len;
+    int i;
+
+    dir_len = strlen(ctx->cache_dir);
+    memcpy(copy_path, ctx->cache_dir, dir_len);
+    memcpy(copy_path+dir_len, entry->id, 32);
+    copy_path[dir_len+32] = '\0';
+    if (stat(copy_path, &st) == -1) return NULL;
+
+    folder = find_folder_by_id(ctx->dgp_root->tree, entry->folder_id);
+    if (folder == NULL || (!folder->files_loaded && folder_cache_fault(folder) == -1)) return NULL;
+
+    file = find_file_by_id(ctx->dgp_root->tree, entry->id);
+    if (file == NULL && (i = find_file_name(folder, entry->name)) != -1) file = folder->files[i];
+    if (file != NULL && file->dirty) return file;
+    if (file == NULL) {
+        do {
+            generate_new_id(id);
+            memcpy(copy_path+dir_len, id, 32);
+        } while (memcmp(id, entry->id, 32) != 0 && access(copy_path, F_OK) == 0);
+        memcpy(copy_path+dir_len, entry->id, 32);
+
+        file = add_file(folder, id, entry->name, st.st_size);
+        if (file == NULL) return NULL;
+    }
+
+    if (set_cache_path(ctx, file) == -1) return NULL;
+    if (strcmp(copy_path, file->cache_path) != 0 && rename(copy_path, file->cache_path) != 0) {
+        perror("rename()");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    set_file_size(file, st.st_size);
+    set_file_complete(file);
+    file->dirty = 1;
+    file->pages_valid = 0;
+    if (ctx->opts.cache_dir != NULL) manifest_remove(&ctx->cache_manifest, file->id);
+    cache_admit(ctx, file);
+    pthread_mutex_unlock(&file->lock);
+
+    return file;
+}
+
+/*
+Mark the files of the journal left by a former mount to be uploaded again, and queue them for write-back
+The journal is written again with their current ids, which may have changed
+*/
+static void journal_recover(dgp_ctx *ctx)
+{
+    journal_entry *entries, *recovered;
+    c_file *file;
+    int i, nb, nb_recovered;
+
+    entries = journal_load(ctx->journal_path, &nb);
+    if (entries == NULL) return;
+
+    recovered = malloc(nb * sizeof(journal_entry));
+    if (recovered == NULL) {
+        perror("malloc()");
+        journal_free(entries, nb);
+        return;
+    }
+
+    nb_recovered = 0;
+    pthread_rwlock_wrlock(&ctx->tree_lock);
+    for (i=0; i<nb; i++) {
+        file = journal_recover_entry(ctx, &entries[i]);
+        if (file == NULL) {
+            fprintf(stderr, "journal_recover(): changes to %s cannot be recovered\n", entries[i].name);
+            continue;
+        }
+        if (journal_fill(&recovered[nb_recovered], file) == 0) nb_recovered++;
+        writeback_push(&ctx->uploads, file->ino);
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    pthread_mutex_lock(&ctx->journal_lock);
+    if (journal_save(ctx->journal_path, recovered, nb_recovered) == -1) fputs("journal_save(): error\n", stderr);
+    pthread_mutex_unlock(&ctx->journal_lock);
+
+    journal_free(recovered, nb_recovered);
+    journal_free(entries, nb);
+}
+
+int dgp_load(dgp_ctx *ctx)
+{
+    struct stat st;
+
+    if (init_api() == -1) {
+        fputs("init_api(): error\n", stderr);
+        return -1;
+    }
+
+    //A snapshot left by a former mount is served at once and revalidated in the background
+    if (ctx->opts.cache_dir != NULL) ctx->dgp_root = snapshot_load(ctx->snapshot_path);
+    ctx->from_snapshot = ctx->dgp_root != NULL;
+    if (ctx->dgp_root == NULL) ctx->dgp_root = get_folders();
+    if (ctx->dgp_root == NULL) {
+        fputs("get_folders(): error\n", stderr);
+        free_api();
+        return -1;
+    }
+
+    if (stat(ctx->cache_dir, &st) == -1) {
+        if (mkdir(ctx->cache_dir, 0770) != 0) {
+            perror("mkdir()");
+            free_root(ctx->dgp_root);
+            ctx->dgp_root = NULL;
+            free_api();
+            return -1;
+        }
+    }
+
+    //The manifest is only written back by a clean unmount, copies written meanwhile are then not trusted after a crash
+    if (ctx->opts.cache_dir != NULL) {
+        if (manifest_load(&ctx->cache_manifest, ctx->manifest_path) == -1) fputs("manifest_load(): error, starting with an empty cache\n", stderr);
+        unlink(ctx->manifest_path);
+    }
+
+    journal_recover(ctx);
+
+    //The copies of the manifest count against the bounds of the cache from now on
+    if (ctx->opts.cache_dir != NULL) cache_evict(ctx, NULL);
+
+    return 0;
+}
+
+static void send_invalidation(void *arg, const uint64_t ino, const char *path)
+{
+    (void)ino;
+    fuse_invalidate_path((struct fuse*)arg, path);
+}
+
+/*
+Make the kernel drop what it keeps about path, once the current request is answered
+*/
+static void invalidate_path(dgp_ctx *ctx, const char *path)
+{
+    notifier_push(&ctx->notify, 0, path);
+}
+
+/*
+Same as invalidate_path() for the folder containing path
+*/
+static void invalidate_parent(dgp_ctx *ctx, const char *path)
+{
+    char subpath[PATH_MAX], name[PATH_MAX];
+
+    get_subpath(path, subpath, name);
+    invalidate_path(ctx, subpath);
+}
+
+static void load_error(void *arg)
+{
+    fputs("dgp_load(): error, unmounting\n", stderr);
+    fuse_exit((struct fuse*)arg);
+}
+
+static void *dgp_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
+{
+    dgp_ctx *ctx;
+
+    cfg->use_ino = 1;
+    //cfg->parallel_direct_writes = 1;
+    ctx = fuse_get_context()->private_data;
+    dgp_want_splice(conn);
+
+    //dgp_open() chooses per file between direct I/O and the page cache
+    cfg->direct_io = 0;
+    cfg->kernel_cache = 0;
+    cfg->auto_cache = 0;
+
+    cfg->entry_timeout = ctx->opts.folder_ttl < ctx->opts.file_ttl ? ctx->opts.folder_ttl : ctx->opts.file_ttl;
+    cfg->attr_timeout = cfg->entry_timeout;
+    cfg->negative_timeout = ctx->opts.negative_ttl;
+
+    if (cfg->entry_timeout > 0 || cfg->negative_timeout > 0 || ctx->opts.page_cache)
+        notifier_start(&ctx->notify, send_invalidation, fuse_get_context()->fuse);
+    dgp_prefetch_start(ctx);
+    dgp_writeback_start(ctx);
+
+    //The tree is loaded in the background so that the mount does not wait for the API
+    if (dgp_load_start(ctx, load_error, fuse_get_context()->fuse) == -1) fuse_exit(fuse_get_context()->fuse);
+
+    return (void*)ctx;
+}
+
+/*
+Upload in progress of a cached copy, between fsync_send() and fsync_commit()
+old_id is the id of the document replaced, new_id the one of the upload, starting with 'n' if nothing was uploaded
+*/
+typedef struct fsync_job {
+    char old_id[32];
+    char new_id[32];
+    size_t size;
+    char uploaded;
+} fsync_job;
+
+/*
+Send the cached copy of file in place of its document, the tree is then updated by fsync_commit()
+Nothing is sent while the copy still holds the content of the document, the file is just clean again
+Must be called with the tree lock held and the lock of file, unless the tree lock is held for writing
+Return 1 if fsync_commit() is needed, 0 if there is nothing to commit, -EIO if the document was left as is
+*/
+static int fsync_send(dgp_ctx *ctx, c_folder *parent, c_file *file, fsync_job *job)
+{
+    struct stat st;
+    uint64_t hash;
+    char hashed;
+
+    if (!file->cached || !file->dirty) return 0;
+
+    //A copy written back to the content of the document has nothing to send
+    hashed = content_hash(file->cache_path, &hash) == 0;
+    if (hashed && file->hashed && hash == file->hash && file->id[0] != 'n') {
+        file->dirty = 0;
+        if (ctx->opts.cache_dir != NULL) manifest_resume(&ctx->cache_manifest, file->id);
+        return 0;
+    }
+
+    if (file->id[0] != 'n' && delete_object(file->id, 1) == -1) {
+        fputs("dgp_internal_fsync(): Error deleting remote file\n", stderr);
+        return -EIO;
+    }
+    if (ctx->opts.cache_dir != NULL) manifest_remove(&ctx->cache_manifest, file->id);
+
+    memcpy(job->old_id, file->id, 32);
+    memcpy(job->new_id, file->id, 32);
+    job->new_id[0] = 'n';
+    job->size = stat(file->cache_path, &st) == 0 ? (size_t)st.st_size : file->size;
+    job->uploaded = 0;
+
+    //The remote document is gone, whatever the copy holds must be uploaded from now on
+    file->hashed = 0;
+
+    if (job->size == 0) {
+        file->dirty = 0;
+        return 1;
+    }
+
+    if (upload_file(file, job->size, parent->id, job->new_id) == -1) {
+        fputs("dgp_internal_fsync(): Error uploading file\n", stderr);
+        memcpy(job->new_id, file->id, 32);
+        job->new_id[0] = 'n';
+        return 1;
+    }
+
+    //Writes from now on make the file dirty again
+    job->uploaded = 1;
+    file->dirty = 0;
+    file->hashed = hashed;
+    file->hash = hash;
+    file->pages_valid = 0;
+
+    return 1;
+}
+
+/*
+Record into the tree the upload of file sent by fsync_send()
+Must be called with the tree lock held for writing
+Return 0 on success, -errno otherwise
+*/
+static int fsync_commit(c_file *file, const fsync_job *job)
+{
+    char new_cache_path[PATH_MAX];
+    size_t dir_len;
+
+    set_file_size(file, job->size);
+    set_file_id(file, job->new_id);
+    if (!job->uploaded) return job->size == 0 ? 0 : -EIO;
+
+    //The cached copy is named after the id, which ends its path, it may have been evicted meanwhile
+    if (!file->cached || file->cache_path == NULL) return 0;
+    dir_len = strlen(file->cache_path)-32;
+    memcpy(new_cache_path, file->cache_path, dir_len);
+    memcpy(new_cache_path+dir_len, job->new_id, 32);
+    new_cache_path[dir_len+32] = '\0';
+
+    if (rename(file->cache_path, new_cache_path) != 0) {
+        perror("rename()");
+        file->cached = 0;
+        return -errno;
+    }
+
+    memcpy(file->cache_path, new_cache_path, dir_len+33);
+
+    return 0;
+}
+
+int dgp_internal_fsync(dgp_ctx *ctx, c_folder *parent, c_file *file)
+{
+    fsync_job job;
+    int r;
+
+    r = fsync_send(ctx, parent, file, &job);
+    if (r != 1) return r;
+
+    return fsync_commit(file, &job);
+}
+
+static void dgp_folder_sync(dgp_ctx *ctx, c_folder *folder)
+{
+    int i;
+
+    for (i=0; i<folder->nb_files; i++) {
+        if (dgp_internal_fsync(ctx, folder, folder->files[i]) != 0) {
+            fprintf(stderr, "dgp_internal_fsync(): Syncing error on %s/%s. Retrying in 2 seconds...\n", folder->name, folder->files[i]->name);
+            sleep(2);
+            if (dgp_internal_fsync(ctx, folder, folder->files[i]) != 0)
+                fprintf(stderr, "dgp_internal_fsync(): Syncing error on %s/%s. Manual upload needed\n", folder->name, folder->files[i]->name);
+        }
+    }
+    for (i=0; i<folder->nb_folders; i++) dgp_folder_sync(ctx, folder->folders[i]);
+}
+
+/*
+Record into the manifest the complete cached copies of folder and its subfolders that match their document
+*/
+static void dgp_folder_manifest(dgp_ctx *ctx, c_folder *folder)
+{
+    c_file *file;
+    size_t size;
+    int i;
+
+    for (i=0; i<folder->nb_files; i++) {
+        file = folder->files[i];
+        if (!file->cached || file->dirty || file->id[0] == 'n') continue;
+        if (manifest_lookup(&ctx->cache_manifest, file->id, &size, NULL) == 0 && size == file->size) continue;
+        manifest_set(&ctx->cache_manifest, file->id, file->size, "");
+    }
+    for (i=0; i<folder->nb_folders; i++) dgp_folder_manifest(ctx, folder->folders[i]);
+}
+
+/*
+Count the files of folder and its subfolders still holding changes, and fill entries with them if it is not NULL
+*/
+static void collect_dirty_files(const c_folder *folder, journal_entry *entries, int *nb)
+{
+    int i;
+
+    for (i=0; i<folder->nb_files; i++) {
+        if (!folder->files[i]->cached || !folder->files[i]->dirty) continue;
+        if (entries == NULL || journal_fill(&entries[*nb], folder->files[i]) == 0) (*nb)++;
+    }
+    for (i=0; i<folder->nb_folders; i++) collect_dirty_files(folder->folders[i], entries, nb);
+}
+
+/*
+Tell whether name is the copy of one of the nb entries
+*/
+static char journal_has(const journal_entry *entries, const int nb, const char *name)
+{
+    int i;
+
+    if (strlen(name) != 32) return 0;
+    for (i=0; i<nb; i++) {
+        if (!memcmp(entries[i].id, name, 32)) return 1;
+    }
+
+    return 0;
+}
+
+/*
+Tell whether name is a cached copy, named after the 32 characters of an id, or a temporary file left by a save
+*/
+static char cache_entry_owned(const char *name)
+{
+    if (strlen(name) == 32) return 1;
+
+    return !strcmp(MANIFEST_NAME ".tmp", name) || !strcmp(SNAPSHOT_NAME ".tmp", name) || !strcmp(JOURNAL_NAME ".tmp", name);
+}
+
+void dgp_unload(dgp_ctx *ctx)
+{
+    DIR *directory;
+    struct dirent *entry;
+    journal_entry *kept;
+    char filename[PATH_MAX];
+    size_t dir_len, name_len;
+    int nb_kept;
+
+    if (!ctx->root_loaded) return;
+
+    //Background downloads land their bytes under the read lock, they end before the tree goes away
+    pthread_mutex_lock(&ctx->stream_lock);
+    ctx->streams_stop = 1;
+    while (ctx->streams > 0) pthread_cond_wait(&ctx->stream_cond, &ctx->stream_lock);
+    pthread_mutex_unlock(&ctx->stream_lock);
+
+    pthread_rwlock_wrlock(&ctx->tree_lock);
+    dgp_folder_sync(ctx, ctx->dgp_root);
+
+    //The files still holding changes are left to the next mount, along with their copy
+    nb_kept = 0;
+    collect_dirty_files(ctx->dgp_root, NULL, &nb_kept);
+    kept = malloc((nb_kept > 0 ? nb_kept : 1) * sizeof(journal_entry));
+    nb_kept = 0;
+    if (kept == NULL) perror("malloc()");
+    else {
+        collect_dirty_files(ctx->dgp_root, kept, &nb_kept);
+        if (journal_save(ctx->journal_path, kept, nb_kept) == -1) fputs("journal_save(): error\n", stderr);
+    }
+
+    if (ctx->opts.cache_dir != NULL) {
+        dgp_folder_manifest(ctx, ctx->dgp_root);
+        if (snapshot_save(ctx->dgp_root, ctx->snapshot_path) == -1) fputs("snapshot_save(): error\n", stderr);
+    }
+
+    path_cache_clear(&ctx->paths);
+    cache_lru_clear(&ctx->lru);
+    free_root(ctx->dgp_root);
+    ctx->dgp_root = NULL;
+    pthread_mutex_lock(&ctx->stream_lock);
+    ctx->streams_stop = 0;
+    pthread_mutex_unlock(&ctx->stream_lock);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    free_api();
+
+    directory = opendir(ctx->cache_dir);
+    if (directory == NULL) {
+        perror("opendir()");
+        journal_free(kept, nb_kept);
+        return;
+    }
+
+    //A persistent cache keeps the copies of its manifest, partial copies and the others are removed
+    //Only the entries the daemon creates are touched, cache_dir may hold other files
+    dir_len = strlen(ctx->cache_dir);
+    while ((entry = readdir(directory))) {
+        if (!cache_entry_owned(entry->d_name)) continue;
+        if (journal_has(kept, nb_kept, entry->d_name)) continue;
+
+        name_len = strlen(entry->d_name);
+        if (ctx->opts.cache_dir != NULL && name_len == 32 && manifest_lookup(&ctx->cache_manifest, entry->d_name, NULL, NULL) == 0)
+            continue;
+        if (dir_len + name_len >= PATH_MAX) continue;
+
+        memcpy(filename, ctx->cache_dir, dir_len);
+        memcpy(filename+dir_len, entry->d_name, name_len+1);
+
+        if (remove(filename) == -1) perror("remove()");
+    }
+    closedir(directory);
+    journal_free(kept, nb_kept);
+
+    if (ctx->opts.cache_dir != NULL && manifest_save(&ctx->cache_manifest, ctx->manifest_path) == -1)
+        fputs("manifest_save(): error\n", stderr);
+}
+
+/*
+Build into path, of PATH_MAX bytes, the path of name under folder, or of folder itself if name is NULL
+Return where it starts into path, NULL if it is too long
+*/
+static const char* node_path(const c_folder *folder, const char *name, char *path)
+{
+    const c_folder *ptr;
+    size_t len, pos;
+
+    //The path is built backwards, from the node up to the root
+    pos = PATH_MAX-1;
+    path[pos] = '\0';
+    if (name != NULL) {
+        len = strlen(name);
+        if (len+1 > pos) return NULL;
+        pos -= len;
+        memcpy(path+pos, name, len);
+        path[--pos] = '/';
+    }
+    for (ptr=folder; ptr->parent != NULL; ptr=ptr->parent) {
+        len = strlen(ptr->name);
+        if (len+1 > pos) return NULL;
+        pos -= len;
+        memcpy(path+pos, ptr->name, len);
+        path[--pos] = '/';
+    }
+    if (path[pos] == '\0') path[--pos] = '/';
+
+    return path+pos;
+}
+
+/*
+Make the kernel drop what it keeps about the entries of folder, once the current request is answered
+*/
+static void invalidate_folder(dgp_ctx *ctx, const c_folder *folder)
+{
+    char path[PATH_MAX];
+    const char *start;
+
+    if (ctx->opts.lowlevel) {
+        notifier_push(&ctx->notify, folder->ino, NULL);
+        return;
+    }
+
+    start = node_path(folder, NULL, path);
+    if (start != NULL) invalidate_path(ctx, start);
+}
+
+/*
+Same as invalidate_folder() for file
+*/
+static void invalidate_file(dgp_ctx *ctx, const c_file *file)
+{
+    char path[PATH_MAX];
+    const char *start;
+
+    if (ctx->opts.lowlevel) {
+        notifier_push(&ctx->notify, file->ino, NULL);
+        return;
+    }
+
+    start = node_path(file->parent, file->name, path);
+    if (start != NULL) invalidate_path(ctx, start);
+}
+
+/*
+Tell whether file has local state that revalidation must not drop
+*/
+static char file_busy(const c_file *file)
+{
+    return file->id[0] == 'n' || file->dirty || file->opens > 0 || file->streaming;
+}
+
+static char folder_busy(const c_folder *folder)
+{
+    int i;
+
+    for (i=0; i<folder->nb_files; i++) if (file_busy(folder->files[i])) return 1;
+    for (i=0; i<folder->nb_folders; i++) if (folder_busy(folder->folders[i])) return 1;
+
+    return 0;
+}
+
+/*
+Delete the cached copy of file, if any, before the file is removed from the tree
+*/
+static void drop_cached_copy(dgp_ctx *ctx, c_file *file)
+{
+    cache_lru_remove(&ctx->lru, file);
+    if (ctx->opts.cache_dir != NULL) manifest_remove(&ctx->cache_manifest, file->id);
+    if (file->cache_path != NULL && unlink(file->cache_path) == -1 && errno != ENOENT) perror("unlink()");
+}
+
+static void drop_folder_copies(dgp_ctx *ctx, c_folder *folder)
+{
+    int i;
+
+    for (i=0; i<folder->nb_files; i++) drop_cached_copy(ctx, folder->files[i]);
+    for (i=0; i<folder->nb_folders; i++) drop_folder_copies(ctx, folder->folders[i]);
+}
+
+/*
+Add, move and rename the child folders of parent after the ones of fresh, the same folder into a tree just fetched
+Parents are handled before their children, so a folder is always moved into its final parent
+*/
+static void reconcile_folders(dgp_ctx *ctx, c_folder *parent, const c_folder *fresh)
+{
+    c_folder *folder;
+    const c_folder *f;
+    int i;
+
+    for (i=0; i<fresh->nb_folders; i++) {
+        f = fresh->folders[i];
+        folder = find_folder_by_id(ctx->dgp_root->tree, f->id);
+        if (folder == NULL) {
+            folder = add_folder(parent, f->id, f->name);
+            invalidate_folder(ctx, parent);
+        }
+        else if (folder->parent != parent) {
+            invalidate_folder(ctx, folder->parent);
+            folder = move_folder(folder, parent);
+            invalidate_folder(ctx, parent);
+        }
+        if (folder == NULL) continue;
+
+        if (strcmp(folder->name, f->name) != 0 && rename_folder(folder, f->name) == 0) invalidate_folder(ctx, parent);
+        reconcile_folders(ctx, folder, f);
+    }
+}
+
+/*
+Remove the folders below folder that are gone from fresh, unless they hold local changes
+*/
+static void remove_gone_folders(dgp_ctx *ctx, c_folder *folder, const c_tree *fresh)
+{
+    c_folder *child;
+    int i;
+
+    for (i=folder->nb_folders-1; i>=0; i--) {
+        child = folder->folders[i];
+        if (find_folder_by_id(fresh, child->id) != NULL) remove_gone_folders(ctx, child, fresh);
+        else if (!folder_busy(child)) {
+            drop_folder_copies(ctx, child);
+            remove_folder_rec(folder, i);
+            invalidate_folder(ctx, folder);
+        }
+    }
+}
+
+/*
+Bring the files of folder in line with the ones of fresh, a listing of the same folder just fetched
+Return 1 if anything changed, 0 otherwise
+*/
+static char reconcile_files(dgp_ctx *ctx, c_folder *folder, const c_folder *fresh)
+{
+    c_file *file;
+    const c_file *f;
+    int i, index;
+    char changed = 0;
+
+    for (i=0; i<fresh->nb_files; i++) {
+        f = fresh->files[i];
+        index = find_file_id(folder, f->id);
+        if (index == -1) {
+            //A document moved from another loaded folder keeps its node and cached copy
+            file = find_file_by_id(ctx->dgp_root->tree, f->id);
+            if (file == NULL) add_file(folder, f->id, f->name, f->size);
+            else if (!file_busy(file)) {
+                invalidate_folder(ctx, file->parent);
+                file = move_file(file->parent, folder, file->parent_index);
+                if (file != NULL && strcmp(file->name, f->name) != 0) rename_file(folder, file->parent_index, f->name);
+            }
+            changed = 1;
+            continue;
+        }
+
+        file = folder->files[index];
+        if (strcmp(file->name, f->name) != 0 && rename_file(folder, index, f->name) == 0) changed = 1;
+        if (file->size != f->size && !file_busy(file)) {
+            drop_cached_copy(ctx, file);
+            free(file->cache_path);
+            file->cache_path = NULL;
+            free(file->blocks);
+            file->blocks = NULL;
+            file->cached = 0;
+            file->pages_valid = 0;
+            set_file_size(file, f->size);
+            changed = 1;
+        }
+    }
+
+    for (i=folder->nb_files-1; i>=0; i--) {
+        file = folder->files[i];
+        if (find_file_id(fresh, file->id) != -1 || file_busy(file)) continue;
+        drop_cached_copy(ctx, file);
+        remove_file(folder, i);
+        changed = 1;
+    }
+
+    return changed;
+}
+
+/*
+Append the ids of the loaded folders of the subtree of folder to ids, or only count them if ids is NULL
+*/
+static void collect_loaded_folders(const c_folder *folder, char (*ids)[32], int *nb_ids)
+{
+    int i;
+
+    if (folder->files_loaded) {
+        if (ids != NULL) memcpy(ids[*nb_ids], folder->id, 32);
+        (*nb_ids)++;
+    }
+    for (i=0; i<folder->nb_folders; i++) collect_loaded_folders(folder->folders[i], ids, nb_ids);
+}
+
+/*
+Revalidate a tree served from a snapshot against the API
+The folders are fetched at once, then the listing of each loaded folder, without holding the tree lock meanwhile
+*/
+static void snapshot_revalidate(void *arg)
+{
+    dgp_ctx *ctx = arg;
+    c_folder *fresh, *folder;
+    char (*ids)[32];
+    char *response;
+    int i, nb_ids;
+
+    fresh = get_folders();
+    if (fresh == NULL) {
+        fputs("snapshot_revalidate(): get_folders() error, keeping the snapshot\n", stderr);
+        return;
+    }
+
+    pthread_rwlock_wrlock(&ctx->tree_lock);
+    reconcile_folders(ctx, ctx->dgp_root, fresh);
+    remove_gone_folders(ctx, ctx->dgp_root, fresh->tree);
+    path_cache_clear(&ctx->paths);
+
+    //The snapshot only lists the files of the folders loaded then
+    nb_ids = 0;
+    collect_loaded_folders(ctx->dgp_root, NULL, &nb_ids);
+    ids = malloc((nb_ids+1) * sizeof(*ids));
+    if (ids == NULL) perror("malloc()");
+    nb_ids = 0;
+    if (ids != NULL) collect_loaded_folders(ctx->dgp_root, ids, &nb_ids);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    free_scratch_root(fresh);
+
+    for (i=0; i<nb_ids && !snapshot_worker_stopping(&ctx->snapshots); i++) {
+        response = fetch_folder_content(ids[i]);
+        if (response == NULL) continue;
+
+        fresh = add_folder(NULL, ids[i], NULL);
+        if (fresh == NULL) {
+            free(response);
+            continue;
+        }
+        if (add_folder_content(fresh, response) == 0) {
+            pthread_rwlock_wrlock(&ctx->tree_lock);
+            folder = find_folder_by_id(ctx->dgp_root->tree, ids[i]);
+            if (folder != NULL && folder->files_loaded && reconcile_files(ctx, folder, fresh)) {
+                path_cache_clear(&ctx->paths);
+                invalidate_folder(ctx, folder);
+            }
+            pthread_rwlock_unlock(&ctx->tree_lock);
+        }
+        free_scratch_root(fresh);
+    }
+    free(ids);
+}
+
+static void snapshot_periodic(void *arg)
+{
+    dgp_ctx *ctx = arg;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    if (snapshot_save(ctx->dgp_root, ctx->snapshot_path) == -1) fputs("snapshot_save(): error\n", stderr);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+}
+
+int dgp_snapshot_start(dgp_ctx *ctx)
+{
+    if (ctx->opts.cache_dir == NULL) return 0;
+
+    return snapshot_worker_start(&ctx->snapshots, ctx->opts.snapshot_interval, ctx->from_snapshot ? snapshot_revalidate : NULL, snapshot_periodic, ctx);
+}
+
+/*
+Upload the file of inode ino for the write-back queue
+A file open again is postponed, it may be read or written meanwhile
+The transfer only holds the tree lock for reading, the write lock is taken to record the new id
+*/
+static int writeback_upload(void *arg, const uint64_t ino)
+{
+    dgp_ctx *ctx = arg;
+    c_file *file;
+    fsync_job job;
+    char is_file;
+    int r;
+
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (file == NULL || !is_file) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&file->lock);
+    if (file->opens > 0) {
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return 1;
+    }
+    r = fsync_send(ctx, file->parent, file, &job);
+    pthread_mutex_unlock(&file->lock);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    pthread_rwlock_wrlock(&ctx->tree_lock);
+    file = find_node_by_ino(ctx->dgp_root->tree, ino, &is_file);
+    if (r == 1) {
+        //The file may have been removed or replaced while the lock was released
+        if (file != NULL && is_file && !memcmp(file->id, job.old_id, 32)) r = fsync_commit(file, &job);
+        else r = 0;
+    }
+    if (file != NULL && is_file) {
+        if (r == 0) invalidate_file(ctx, file);
+        else fprintf(stderr, "writeback_upload(): Error uploading %s, retrying later\n", file->name);
+    }
+    journal_write(ctx);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    return r == 0 ? 0 : -1;
+}
+
+int dgp_writeback_start(dgp_ctx *ctx)
+{
+    if (!ctx->opts.writeback) return 0;
+
+    return writeback_start(&ctx->uploads, ctx->opts.writeback_delay, writeback_upload, ctx);
+}
+
+void dgp_writeback_queue(dgp_ctx *ctx, const uint64_t ino)
+{
+    pthread_rwlock_rdlock(&ctx->tree_lock);
+    writeback_push(&ctx->uploads, ino);
+    journal_write(ctx);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+}
+
+static void* load_run(void *arg)
+{
+    dgp_ctx *ctx = arg;
+    char ok;
+
+    ok = dgp_load(ctx) == 0;
+    if (ok) dgp_snapshot_start(ctx);
+
+    pthread_mutex_lock(&ctx->load_lock);
+    if (ok) __atomic_store_n(&ctx->root_loaded, 1, __ATOMIC_RELEASE);
+    else ctx->load_failed = 1;
+    pthread_cond_broadcast(&ctx->load_cond);
+    pthread_mutex_unlock(&ctx->load_lock);
+
+    //The kernel may keep the empty root it was given meanwhile
+    if (ok) invalidate_folder(ctx, ctx->dgp_root);
+    else ctx->load_error(ctx->load_error_arg);
+
+    return NULL;
+}
+
+int dgp_load_start(dgp_ctx *ctx, void (*error)(void *arg), void *arg)
+{
+    ctx->load_error = error;
+    ctx->load_error_arg = arg;
+
+    if (pthread_create(&ctx->load_thread, NULL, load_run, ctx) != 0) {
+        fputs("pthread_create(): error\n", stderr);
+        return -1;
+    }
+    ctx->load_running = 1;
+
+    return 0;
 }
 
-static int dgp_internal_fsync(c_folder *parent, c_file *file)
+void dgp_load_join(dgp_ctx *ctx)
 {
-    char new_id[32], new_cache_path[sizeof(CACHE_PATH)+32];
-    struct stat st;
+    if (!ctx->load_running) return;
 
-    if (!file->cached || !file->dirty) return 0;
+    pthread_join(ctx->load_thread, NULL);
+    ctx->load_running = 0;
+}
 
-    if (file->id[0] != 'n' && delete_object(file->id, 1) == -1) {
-        fputs("dgp_internal_fsync(): Error deleting remote file\n", stderr);
-        return -EIO;
-    }
+int dgp_wait_tree(dgp_ctx *ctx, const int timeout)
+{
+    struct timespec deadline;
+    int r;
 
-    stat(file->cache_path, &st);
-    file->size = st.st_size;
+    if (__atomic_load_n(&ctx->root_loaded, __ATOMIC_ACQUIRE)) return 0;
 
-    if (file->size == 0) {
-        file->dirty = 0;
-        file->id[0] = 'n';
-        return 0;
-    }
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout;
 
-    if (upload_file(file, parent->id, new_id) == -1) {
-        fputs("dgp_internal_fsync(): Error uploading file\n", stderr);
-        file->id[0] = 'n';
-        return -EIO;
+    pthread_mutex_lock(&ctx->load_lock);
+    while (timeout > 0 && !ctx->root_loaded && !ctx->load_failed) {
+        if (pthread_cond_timedwait(&ctx->load_cond, &ctx->load_lock, &deadline) == ETIMEDOUT) break;
     }
+    r = ctx->root_loaded ? 0 : ctx->load_failed ? -EIO : -EAGAIN;
+    pthread_mutex_unlock(&ctx->load_lock);
 
-    memcpy(file->id, new_id, 32);
-    file->dirty = 0;
-    memcpy(new_cache_path, file->cache_path, sizeof(CACHE_PATH)-1);
-    memcpy(new_cache_path+sizeof(CACHE_PATH)-1, new_id, 32);
-    new_cache_path[sizeof(CACHE_PATH)+31] = '\0';
+    return r;
+}
 
-    if (rename(file->cache_path, new_cache_path) != 0) {
-        perror("rename()");
-        file->cached = 0;
-        return -errno;
+int dgp_set_cache_dir(dgp_ctx *ctx, const char *dir)
+{
+    char *cache_dir, *manifest_path, *snapshot_path, *journal_path;
+    size_t len;
+
+    len = strlen(dir);
+    if (dir[0] != '/' || len > DGP_CACHE_DIR_MAX) {
+        fprintf(stderr, "cache_dir must be an absolute path of at most %d bytes\n", DGP_CACHE_DIR_MAX);
+        return -1;
     }
 
-    memcpy(file->cache_path, new_cache_path, sizeof(CACHE_PATH)+32);
+    cache_dir = malloc(len+2);
+    manifest_path = malloc(len+1+sizeof(MANIFEST_NAME));
+    snapshot_path = malloc(len+1+sizeof(SNAPSHOT_NAME));
+    journal_path = malloc(len+1+sizeof(JOURNAL_NAME));
+    if (cache_dir == NULL || manifest_path == NULL || snapshot_path == NULL || journal_path == NULL) {
+        perror("malloc()");
+        free(cache_dir);
+        free(manifest_path);
+        free(snapshot_path);
+        free(journal_path);
+        return -1;
+    }
+    memcpy(cache_dir, dir, len);
+    if (cache_dir[len-1] != '/') cache_dir[len++] = '/';
+    cache_dir[len] = '\0';
+    memcpy(manifest_path, cache_dir, len);
+    memcpy(manifest_path+len, MANIFEST_NAME, sizeof(MANIFEST_NAME));
+    memcpy(snapshot_path, cache_dir, len);
+    memcpy(snapshot_path+len, SNAPSHOT_NAME, sizeof(SNAPSHOT_NAME));
+    memcpy(journal_path, cache_dir, len);
+    memcpy(journal_path+len, JOURNAL_NAME, sizeof(JOURNAL_NAME));
+
+    free(ctx->cache_dir);
+    free(ctx->manifest_path);
+    free(ctx->snapshot_path);
+    free(ctx->journal_path);
+    ctx->cache_dir = cache_dir;
+    ctx->manifest_path = manifest_path;
+    ctx->snapshot_path = snapshot_path;
+    ctx->journal_path = journal_path;
 
     return 0;
 }
 
-static void dgp_folder_sync(c_folder *folder)
+dgp_ctx* dgp_ctx_new()
 {
-    int i;
+    dgp_ctx *ctx;
 
-    for (i=0; i<folder->nb_files; i++) {
-        if (dgp_internal_fsync(folder, folder->files[i]) != 0) {
-            fprintf(stderr, "dgp_internal_fsync(): Syncing error on %s/%s. Retrying in 2 seconds...\n", folder->name, folder->files[i]->name);
-            sleep(2);
-            if (dgp_internal_fsync(folder, folder->files[i]) != 0)
-                fprintf(stderr, "dgp_internal_fsync(): Syncing error on %s/%s. Manual upload needed\n", folder->name, folder->files[i]->name);
-        }
+    ctx = malloc(sizeof(dgp_ctx));
+    if (ctx == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+    ctx->dgp_root = NULL;
+    ctx->root_loaded = 0;
+    ctx->load_failed = 0;
+    ctx->load_running = 0;
+    ctx->load_error = NULL;
+    ctx->load_error_arg = NULL;
+    ctx->cache_dir = NULL;
+    ctx->manifest_path = NULL;
+    ctx->snapshot_path = NULL;
+    ctx->journal_path = NULL;
+    ctx->from_snapshot = 0;
+    if (dgp_set_cache_dir(ctx, CACHE_PATH) == -1) {
+        free(ctx);
+        return NULL;
     }
-    for (i=0; i<folder->nb_folders; i++) dgp_folder_sync(folder->folders[i]);
+    manifest_init(&ctx->cache_manifest);
+    cache_lru_init(&ctx->lru);
+    snapshot_worker_init(&ctx->snapshots);
+    writeback_init(&ctx->uploads);
+    pthread_mutex_init(&ctx->journal_lock, NULL);
+    ctx->streams = 0;
+    ctx->streams_stop = 0;
+    pthread_mutex_init(&ctx->stream_lock, NULL);
+    pthread_cond_init(&ctx->stream_cond, NULL);
+    pthread_rwlock_init(&ctx->tree_lock, NULL);
+    path_cache_init(&ctx->paths);
+    notifier_init(&ctx->notify);
+    prefetcher_init(&ctx->prefetch);
+    prefetcher_init(&ctx->seq_prefetch);
+    pthread_mutex_init(&ctx->seq_lock, NULL);
+    pthread_mutex_init(&ctx->load_lock, NULL);
+    pthread_cond_init(&ctx->load_cond, NULL);
+    memset(&ctx->opts, 0, sizeof(dgp_opts));
+    ctx->opts.folder_ttl = DGP_DEFAULT_TTL;
+    ctx->opts.file_ttl = DGP_DEFAULT_TTL;
+    ctx->opts.negative_ttl = 0;
+    ctx->opts.block_size = DGP_DEFAULT_BLOCK_SIZE;
+    ctx->opts.prefetch_depth = 0;
+    ctx->opts.prefetch_threads = 1;
+    ctx->opts.seq_prefetch_files = 0;
+    ctx->opts.seq_prefetch_bytes = DGP_DEFAULT_SEQ_PREFETCH_BYTES;
+    ctx->opts.snapshot_interval = DGP_DEFAULT_SNAPSHOT_INTERVAL;
+    ctx->opts.load_timeout = DGP_DEFAULT_LOAD_TIMEOUT;
+    ctx->opts.writeback_delay = DGP_DEFAULT_WRITEBACK_DELAY;
+
+    return ctx;
 }
 
-static void dgp_destroy(void* private_data)
+void dgp_ctx_free(dgp_ctx *ctx)
 {
-    dgp_ctx *ctx = (dgp_ctx*)private_data;
-    c_folder *root;
-    DIR *directory;
-    struct dirent *entry;
-    char filename[sizeof(CACHE_PATH)+34];
-
-    dgp_folder_sync(ctx->dgp_root);
-
-    free_root(ctx->dgp_root);
-    free_api();
+    notifier_free(&ctx->notify);
+    prefetcher_free(&ctx->prefetch);
+    prefetcher_free(&ctx->seq_prefetch);
+    pthread_mutex_destroy(&ctx->seq_lock);
+    path_cache_free(&ctx->paths);
+    manifest_free(&ctx->cache_manifest);
+    cache_lru_free(&ctx->lru);
+    snapshot_worker_free(&ctx->snapshots);
+    writeback_free(&ctx->uploads);
+    pthread_mutex_destroy(&ctx->journal_lock);
+    pthread_mutex_destroy(&ctx->stream_lock);
+    pthread_cond_destroy(&ctx->stream_cond);
+    pthread_rwlock_destroy(&ctx->tree_lock);
+    pthread_mutex_destroy(&ctx->load_lock);
+    pthread_cond_destroy(&ctx->load_cond);
+    free(ctx->opts.cache_dir);
+    free(ctx->cache_dir);
+    free(ctx->manifest_path);
+    free(ctx->snapshot_path);
+    free(ctx->journal_path);
     free(ctx);
+}
 
-    directory = opendir(CACHE_PATH);
-    if (directory == NULL) {
-        perror("opendir()");
-        return;
-    }
-
-    while ((entry = readdir(directory))) {
-        if (!strcmp(".", entry->d_name) || !strcmp("..", entry->d_name)) {
-            continue;
-        }
-
-        memcpy(filename, CACHE_PATH, strlen(CACHE_PATH));
-        filename[strlen(CACHE_PATH)] = '/';
-        memcpy(filename+strlen(CACHE_PATH)+1, entry->d_name, 32);
-        filename[strlen(CACHE_PATH)+33] = '\0';
-
-        if (remove(filename) == -1) perror("remove()");
-    }
-    closedir(directory);
+static void dgp_destroy(void* private_data)
+{
+    dgp_ctx *ctx = (dgp_ctx*)private_data;
 
-    return;
+    dgp_load_join(ctx);
+    notifier_stop(&ctx->notify);
+    snapshot_worker_stop(&ctx->snapshots);
+    //The uploads still queued are run by dgp_unload()
+    writeback_stop(&ctx->uploads);
+    prefetcher_stop(&ctx->prefetch);
+    prefetcher_stop(&ctx->seq_prefetch);
+    dgp_unload(ctx);
+    dgp_ctx_free(ctx);
 }
 
-static int dgp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+void dgp_fill_stat(struct stat *stbuf, const c_folder *folder, const c_file *file, const uid_t uid, const gid_t gid)
 {
-    c_folder *folder;
-    int index;
     struct timespec now;
-    struct fuse_context *fctx = fuse_get_context();
-    dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
     timespec_get(&now, TIME_UTC);
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index == -1) {
-        //Ignored by FUSE
-        stbuf->st_dev = 0;
-        stbuf->st_blksize = 0;
-        stbuf->st_ino = 0;
-        stbuf->st_rdev = 0;
-        stbuf->st_blocks = 0;
+    //Ignored by FUSE
+    stbuf->st_dev = 0;
+    stbuf->st_blksize = 0;
+    stbuf->st_rdev = 0;
+    stbuf->st_blocks = 0;
+
+    if (file == NULL) {
+        stbuf->st_ino = folder->ino;
 
         //Directory with rwxrwx---
         stbuf->st_mode = (S_IFMT & S_IFDIR) | S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP;
         stbuf->st_nlink = 2 + folder->nb_folders;
-        stbuf->st_uid = fctx->uid;
-        stbuf->st_gid = fctx->gid;
         stbuf->st_size = 0;
-        stbuf->st_atim = now;
-        stbuf->st_mtim = now;
-        stbuf->st_ctim = now;
     }
     else {
-        //Ignored by FUSE
-        stbuf->st_dev = 0;
-        stbuf->st_blksize = 0;
-        stbuf->st_ino = 0;
-        stbuf->st_rdev = 0;
-        stbuf->st_blocks = 0;
+        stbuf->st_ino = file->ino;
 
         //File with rw-rw----
         stbuf->st_mode = (S_IFMT & S_IFREG) | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
         stbuf->st_nlink = 1;
-        stbuf->st_uid = fctx->uid;
-        stbuf->st_gid = fctx->gid;
-        stbuf->st_size = folder->files[index]->size;
-        stbuf->st_atim = now;
-        stbuf->st_mtim = now;
-        stbuf->st_ctim = now;
+        stbuf->st_size = file->size;
+    }
+    stbuf->st_uid = uid;
+    stbuf->st_gid = gid;
+    stbuf->st_atim = now;
+    stbuf->st_mtim = now;
+    stbuf->st_ctim = now;
+}
+
+void dgp_fill_stat_entry(struct stat *stbuf, const c_meta_entry *entry, const uid_t uid, const gid_t gid)
+{
+    struct timespec now;
+
+    timespec_get(&now, TIME_UTC);
+
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = entry->ino;
+    if (entry->flags & META_DIR)
+        stbuf->st_mode = (S_IFMT & S_IFDIR) | S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP;
+    else
+        stbuf->st_mode = (S_IFMT & S_IFREG) | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+    stbuf->st_nlink = entry->nlink;
+    stbuf->st_size = entry->size;
+    stbuf->st_uid = uid;
+    stbuf->st_gid = gid;
+    stbuf->st_atim = now;
+    stbuf->st_mtim = now;
+    stbuf->st_ctim = now;
+}
+
+void dgp_fill_stat_root(struct stat *stbuf, const uid_t uid, const gid_t gid)
+{
+    c_meta_entry entry;
+
+    memset(&entry, 0, sizeof(c_meta_entry));
+    entry.ino = DGP_ROOT_INO;
+    entry.nlink = 2;
+    entry.flags = META_DIR;
+    dgp_fill_stat_entry(stbuf, &entry, uid, gid);
+}
+
+/*
+Served from the published listings without any lock when possible
+Otherwise the path is resolved under the tree lock and the listings on the way are published for the next time
+The root is answered at once as an empty folder while the tree is loading, other paths wait for it
+*/
+static int dgp_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+    const c_folder *fast_folder;
+    const c_meta_entry *entry;
+    const c_meta *meta;
+    c_folder *folder, *warm;
+    int index, r;
+    struct fuse_context *fctx = fuse_get_context();
+    dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
+
+    if (!strcmp(path, "/")) {
+        r = dgp_wait_tree(ctx, 0);
+        if (r == -EAGAIN) {
+            dgp_fill_stat_root(stbuf, fctx->uid, fctx->gid);
+            return 0;
+        }
+    }
+    else r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
+
+    epoch_enter();
+    r = lookup_path_fast(path, ctx, &fast_folder, &entry);
+    if (r == 0 && entry != NULL) dgp_fill_stat_entry(stbuf, entry, fctx->uid, fctx->gid);
+    else if (r == 0) {
+        meta = peek_folder_meta(fast_folder);
+        if (meta != NULL) fill_stat_meta(stbuf, fast_folder->ino, meta, fctx->uid, fctx->gid);
+        else r = -EAGAIN;
+    }
+    epoch_exit();
+    if (r != -EAGAIN) return r;
+
+    folder = lock_path(path, &index, ctx, 0, 0);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOENT;
     }
 
+    if (index == -1) dgp_fill_stat(stbuf, folder, NULL, fctx->uid, fctx->gid);
+    else dgp_fill_stat(stbuf, folder, folder->files[index], fctx->uid, fctx->gid);
+
+    warm = index == -1 && folder->parent != NULL ? folder->parent : folder;
+    for (; warm != NULL; warm = warm->parent) get_folder_meta(warm);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
     return 0;
 }
 
@@ -306,47 +2150,113 @@ static int dgp_access(const char *path, int mask)
     return 0;
 }
 
+/*
+Fill the listing of a folder for dgp_readdir()
+Entries are ".", "..", the child folders then the child files
+The offset given to filler is the cookie of the entry, which a listing interrupted by a full buffer
+resumes past, so that children added or removed meanwhile do not shift the others
+With FUSE_READDIR_PLUS, complete attributes are returned with each entry
+*/
+static void fill_dir(void *buf, fuse_fill_dir_t filler, const off_t offset, const enum fuse_readdir_flags flags,
+                     const uint64_t ino, const c_meta *meta, const struct fuse_context *fctx)
+{
+    const c_meta_entry *entry;
+    struct stat st;
+    enum fuse_fill_dir_flags fill_flags;
+    int i;
+
+    fill_flags = flags & FUSE_READDIR_PLUS ? FUSE_FILL_DIR_PLUS : 0;
+
+    if (offset < 1) {
+        fill_stat_meta(&st, ino, meta, fctx->uid, fctx->gid);
+        if (filler(buf, ".", &st, 1, fill_flags)) return;
+    }
+    if (offset < 2) {
+        fill_stat_meta(&st, meta->parent_ino, meta, fctx->uid, fctx->gid);
+        if (filler(buf, "..", &st, 2, fill_flags)) return;
+    }
+
+    for (i = offset < 2 ? 0 : find_meta_cookie(meta, offset); i < meta->nb_entries; i++) {
+        entry = &meta->entries[i];
+        dgp_fill_stat_entry(&st, entry, fctx->uid, fctx->gid);
+        if (filler(buf, meta->names + entry->name_off, &st, entry->cookie, fill_flags))
+            break;
+    }
+}
+
+/*
+Served from the published listing without any lock when possible, as dgp_getattr()
+The root is listed empty if the tree is still loading once load_timeout is over
+*/
 static int dgp_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
                        struct fuse_file_info *fi, enum fuse_readdir_flags flags)
 {
+    const c_folder *fast_folder;
+    const c_meta_entry *entry;
+    const c_meta *meta;
+    c_meta empty;
     c_folder *folder;
-    int index;
-    struct stat st;
+    int index, r;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index != -1) return -ENOTDIR;
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r == -EAGAIN && !strcmp(path, "/")) {
+        memset(&empty, 0, sizeof(c_meta));
+        empty.parent_ino = DGP_ROOT_INO;
+        fill_dir(buf, filler, offset, flags, DGP_ROOT_INO, &empty, fctx);
+        return 0;
+    }
+    if (r != 0) return r;
+
+    epoch_enter();
+    r = lookup_path_fast(path, ctx, &fast_folder, &entry);
+    if (r == 0 && entry != NULL && !(entry->flags & META_DIR)) r = -ENOTDIR;
+    else if (r == 0) {
+        meta = peek_folder_meta(fast_folder);
+        if (meta != NULL && meta->files_loaded) {
+            fill_dir(buf, filler, offset, flags, fast_folder->ino, meta, fctx);
+            if (offset == 0) dgp_prefetch_children(ctx, meta);
+        }
+        else r = -EAGAIN;
+    }
+    epoch_exit();
+    if (r != -EAGAIN) return r;
 
-    for (index=0; index < folder->nb_folders; index++) {
-        memset(&st, 0, sizeof(st));
-        st.st_ino = 0;
-        st.st_mode = (S_IFMT & S_IFDIR) | S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP;
-        if (filler(buf, folder->folders[index]->name, &st, 0, 0))
-            return 0;
+    folder = lock_path(path, &index, ctx, 0, 1);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOENT;
+    }
+    if (index != -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOTDIR;
     }
 
-    if (!folder->files_loaded && folder_cache_fault(folder) == -1) return -EIO;
-    for (index=0; index < folder->nb_files; index++) {
-        memset(&st, 0, sizeof(st));
-        st.st_ino = 0;
-        st.st_mode = (S_IFMT & S_IFREG) | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
-        if (filler(buf, folder->files[index]->name, &st, 0, 0))
-            break;
+    meta = get_folder_meta(folder);
+    if (meta == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOMEM;
     }
 
+    fill_dir(buf, filler, offset, flags, folder->ino, meta, fctx);
+    if (offset == 0) dgp_prefetch_children(ctx, meta);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
     return 0;
 }
 
 static int dgp_mkdir(const char *path, mode_t mode)
 {
     c_folder *folder;
-    int index, path_len;
+    int index, path_len, r;
     char *subpath, *name, id[32];
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
+
     path_len = strlen(path);
     subpath = malloc((path_len+1)*sizeof(char));
     if (subpath == NULL) {
@@ -362,13 +2272,15 @@ static int dgp_mkdir(const char *path, mode_t mode)
 
     get_subpath(path, subpath, name);
 
-    folder = resolve_path(subpath, &index, ctx);
+    folder = lock_path(subpath, &index, ctx, 1, 0);
     if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(name);
         free(subpath);
         return -ENOENT;
     }
     if (index != -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(name);
         free(subpath);
         return -ENOTDIR;
@@ -376,6 +2288,7 @@ static int dgp_mkdir(const char *path, mode_t mode)
 
     if (create_folder(name, folder->id, id) == -1) {
         fputs("create_folder(): API error\n", stderr);
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(name);
         free(subpath);
         return -EIO;
@@ -383,10 +2296,13 @@ static int dgp_mkdir(const char *path, mode_t mode)
 
     if (add_folder(folder, id, name) == NULL) {
         fputs("add_folder(): Error creating folder into c_folder struct\n", stderr);
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(name);
         free(subpath);
         return -EIO;
     }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    invalidate_path(ctx, subpath);
 
     free(name);
     free(subpath);
@@ -398,24 +2314,42 @@ static int dgp_unlink(const char *path)
 {
     c_folder *folder;
     c_file *file;
-    int index;
+    int index, r;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index == -1) return -EISDIR;
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
+
+    folder = lock_path(path, &index, ctx, 1, 0);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOENT;
+    }
+    if (index == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -EISDIR;
+    }
 
     file = folder->files[index];
 
-    if (file->id[0] != 'n' && delete_object(file->id, 1) == -1) return -EIO;
+    if (file->id[0] != 'n' && delete_object(file->id, 1) == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -EIO;
+    }
 
-    if (file->cached && unlink(file->cache_path) == 0) file->cached = 0;
+    if (file->cache_path != NULL && unlink(file->cache_path) == 0) file->cached = 0;
+    if (ctx->opts.cache_dir != NULL) manifest_remove(&ctx->cache_manifest, file->id);
+    cache_lru_remove(&ctx->lru, file);
 
+    path_cache_invalidate(&ctx->paths, path);
     if (remove_file(folder, index) == -1) {
         fputs("dgp_unlink(): Error removing file from struct\n", stderr);
+        pthread_rwlock_unlock(&ctx->tree_lock);
         return -EIO;
     }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    invalidate_parent(ctx, path);
 
     return 0;
 }
@@ -423,70 +2357,77 @@ static int dgp_unlink(const char *path)
 static int dgp_rmdir(const char *path)
 {
     c_folder *folder;
-    int index;
+    int index, r;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index != -1) return -ENOTDIR;
-    if (folder->nb_files + folder->nb_folders > 0) return -ENOTEMPTY;
-    if (folder == ctx->dgp_root) return -EPERM;
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
+
+    folder = lock_path(path, &index, ctx, 1, 0);
+    if (folder == NULL) r = -ENOENT;
+    else if (index != -1) r = -ENOTDIR;
+    else if (folder->nb_files + folder->nb_folders > 0) r = -ENOTEMPTY;
+    else if (folder == ctx->dgp_root) r = -EPERM;
+    else r = 0;
+    if (r != 0) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return r;
+    }
 
-    if (delete_object(folder->id, 0) == -1) return -EIO;
+    if (delete_object(folder->id, 0) == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -EIO;
+    }
 
+    path_cache_invalidate(&ctx->paths, path);
     if (remove_folder(folder) == -1) {
         fputs("dgp_rmdir(): Error removing folder from struct\n", stderr);
+        pthread_rwlock_unlock(&ctx->tree_lock);
         return -EIO;
     }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    invalidate_parent(ctx, path);
 
     return 0;
 }
 
+/*
+Both rename helpers run with the tree lock held for writing
+*/
 static int dgp_rename_simple(const char *from, const char *to, const char *to_name)
 {
     c_folder *from_folder, *to_folder;
     c_file *from_file;
-    int from_index, to_index, new_name_len;
-    char *ptr;
+    int from_index, to_index;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    new_name_len = strlen(to_name);
-
-    from_folder = resolve_path(from, &from_index, ctx);
-    to_folder = resolve_path(to, &to_index, ctx);
+    from_folder = resolve_path(from, &from_index, ctx, NULL);
+    to_folder = resolve_path(to, &to_index, ctx, NULL);
     if (from_folder == NULL) return -ENOENT;
     if (to_folder != NULL) return -EEXIST;
 
     if (from_index == -1) { //folder
         if (rename_object(from_folder->id, to_name, 0) == -1) return -EIO;
-        ptr = realloc(from_folder->name, new_name_len+1);
-        if (ptr == NULL) {
-            perror("realloc()");
+        if (rename_folder(from_folder, to_name) == -1) {
             if (rename_object(from_folder->id, from_folder->name, 0) == -1) {
                 fputs("dgp_rename_simple(): Unrecoverable error\n", stderr);
                 return -EIO;
             }
             return -EIO;
         }
-        from_folder->name = ptr;
-        memcpy(from_folder->name, to_name, new_name_len+1);
     }
     else { //file
         from_file = from_folder->files[from_index];
         if (rename_object(from_file->id, to_name, 1) == -1) return -EIO;
-        ptr = realloc(from_file->name, new_name_len+1);
-        if (ptr == NULL) {
-            perror("realloc()");
+        if (rename_file(from_folder, from_index, to_name) == -1) {
             if (rename_object(from_file->id, from_file->name, 0) == -1) {
                 fputs("dgp_rename_simple(): Unrecoverable error\n", stderr);
                 return -EIO;
             }
             return -EIO;
         }
-        from_file->name = ptr;
-        memcpy(from_file->name, to_name, new_name_len+1);
     }
 
     return 0;
@@ -496,19 +2437,16 @@ static int dgp_rename_move(const char *from, const char *to, const char *to_subp
 {
     c_folder *from_folder, *to_folder;
     c_file *from_file;
-    int from_index, to_index, new_name_len;
-    char *ptr;
+    int from_index, to_index;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    new_name_len = strlen(to_name);
-
-    from_folder = resolve_path(from, &from_index, ctx);
-    to_folder = resolve_path(to, &to_index, ctx);
+    from_folder = resolve_path(from, &from_index, ctx, NULL);
+    to_folder = resolve_path(to, &to_index, ctx, NULL);
     if (from_folder == NULL) return -ENOENT;
     if (to_folder != NULL) return -EEXIST;
 
-    to_folder = resolve_path(to_subpath, &to_index, ctx);
+    to_folder = resolve_path(to_subpath, &to_index, ctx, NULL);
     if (to_folder == NULL) return -ENOENT;
     if (to_index != -1) return -ENOTDIR;
 
@@ -521,14 +2459,10 @@ static int dgp_rename_move(const char *from, const char *to, const char *to_subp
             return -EIO;
         }
 
-        ptr = realloc(from_folder->name, new_name_len+1);
-        if (ptr == NULL) {
-            perror("realloc()");
+        if (rename_folder(from_folder, to_name) == -1) {
             fputs("dgp_rename_move(): Unrecoverable error\n", stderr);
-            return -errno;
+            return -EIO;
         }
-        from_folder->name = ptr;
-        memcpy(from_folder->name, to_name, new_name_len+1);
     }
     else { //file
         from_file = from_folder->files[from_index];
@@ -540,14 +2474,10 @@ static int dgp_rename_move(const char *from, const char *to, const char *to_subp
             return -EIO;
         }
 
-        ptr = realloc(from_file->name, new_name_len+1);
-        if (ptr == NULL) {
-            perror("realloc()");
+        if (rename_file(to_folder, to_folder->nb_files-1, to_name) == -1) {
             fputs("dgp_rename_move(): Unrecoverable error\n", stderr);
-            return -errno;
+            return -EIO;
         }
-        from_file->name = ptr;
-        memcpy(from_file->name, to_name, new_name_len+1);
     }
 
     return 0;
@@ -557,6 +2487,10 @@ static int dgp_rename(const char *from, const char *to, unsigned int flags)
 {
     int r, from_path_len, from_name_len, to_path_len, to_name_len;
     char *from_subpath, *from_name, *to_subpath, *to_name;
+    dgp_ctx *ctx = (dgp_ctx*)fuse_get_context()->private_data;
+
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
 
     from_path_len = strlen(from);
     to_path_len = strlen(to);
@@ -591,9 +2525,18 @@ static int dgp_rename(const char *from, const char *to, unsigned int flags)
     get_subpath(from, from_subpath, from_name);
     get_subpath(to, to_subpath, to_name);
 
+    pthread_rwlock_wrlock(&ctx->tree_lock);
     if (strcmp(from_subpath, to_subpath) == 0) r = dgp_rename_simple(from, to, to_name);
     else r = dgp_rename_move(from, to, to_subpath, to_name);
 
+    path_cache_invalidate(&ctx->paths, from);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    if (r == 0) {
+        invalidate_path(ctx, from_subpath);
+        if (strcmp(from_subpath, to_subpath) != 0) invalidate_path(ctx, to_subpath);
+    }
+
     free(from_subpath);
     free(from_name);
     free(to_subpath);
@@ -620,33 +2563,65 @@ static int dgp_chown(const char *path, uid_t uid, gid_t gid, struct fuse_file_in
 static int dgp_truncate(const char *path, off_t size, struct fuse_file_info *fi)
 {
     int index, r;
+    uint64_t ino;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
     c_folder *folder;
     c_file *file;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index == -1) return -EISDIR;
-    file = folder->files[index];
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
 
-    if (!file->cached && file_cache_fault(file) == -1) return -EIO;
+    //A background download needs the read lock to end, it is waited for before taking the write lock
+    while (1) {
+        folder = lock_path(path, &index, ctx, 1, 0);
+        if (folder == NULL) {
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            return -ENOENT;
+        }
+        if (index == -1) {
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            return -EISDIR;
+        }
+        file = folder->files[index];
+        if (!file->streaming) break;
+        ino = file->ino;
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        dgp_stream_wait(ctx, ino);
+    }
+
+    if (dgp_open_cache(ctx, file, O_RDWR) != 0) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -EIO;
+    }
 
 	if (fi != NULL) {
-		if (ftruncate(fi->fh, size) == -1) {
+		if (ftruncate(DGP_HANDLE(fi)->fd, size) == -1) {
             perror("ftruncate()");
-            return -errno;
+            r = -errno;
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            return r;
         }
     }
 	else {
 		if (truncate(file->cache_path, size) == -1) {
             perror("truncate()");
-            return -errno;
+            r = -errno;
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            return r;
         }
     }
 
-    file->size = size;
-    file->dirty = 1;
+    set_file_size(file, size);
+    dgp_file_dirty(ctx, file);
+    ino = file->ino;
+    if (fi != NULL) DGP_HANDLE(fi)->written = 1;
+    //Without a handle, no release will upload the file
+    else if (!ctx->opts.writeback) dgp_internal_fsync(ctx, folder, file);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    invalidate_path(ctx, path);
+
+    if (fi == NULL && ctx->opts.writeback) dgp_writeback_queue(ctx, ino);
 
 	return 0;
 }
@@ -655,13 +2630,14 @@ static int dgp_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
     c_folder *folder;
     c_file *file;
-    int index, path_len, fh;
+    dgp_handle *fh;
+    int index, path_len, fd, r;
     char *subpath, *name, id[32];
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder != NULL) return -EEXIST;
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
 
     path_len = strlen(path);
     subpath = malloc(path_len+1);
@@ -678,13 +2654,23 @@ static int dgp_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 
     get_subpath(path, subpath, name);
 
-    folder = resolve_path(subpath, &index, ctx);
+    folder = lock_path(path, &index, ctx, 1, 0);
+    if (folder != NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        free(subpath);
+        free(name);
+        return -EEXIST;
+    }
+
+    folder = resolve_path(subpath, &index, ctx, NULL);
     if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(subpath);
         free(name);
         return -ENOENT;
     }
     if (index != -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(subpath);
         free(name);
         return -ENOTDIR;
@@ -697,33 +2683,49 @@ static int dgp_create(const char *path, mode_t mode, struct fuse_file_info *fi)
     file = add_file(folder, id, name, 0);
     if (file == NULL) {
         fputs("dgp_create(): Error adding file to struct\n", stderr);
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(subpath);
         free(name);
         return -EIO;
     }
 
-    file->cache_path = malloc(sizeof(CACHE_PATH)+32);
-    if (file->cache_path == NULL) {
-        perror("malloc()");
+    if (set_cache_path(ctx, file) == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(subpath);
         free(name);
-        return -errno;
+        return -ENOMEM;
     }
-    memcpy(file->cache_path, CACHE_PATH, sizeof(CACHE_PATH)-1);
-    memcpy(file->cache_path+sizeof(CACHE_PATH)-1, id, 32);
-    file->cache_path[sizeof(CACHE_PATH)+31] = '\0';
 
-    fh = open(file->cache_path, fi->flags, mode);
-    if (fh == -1) {
+    fd = open(file->cache_path, fi != NULL ? fi->flags : O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd == -1) {
         perror("open()");
+        r = -errno;
+        pthread_rwlock_unlock(&ctx->tree_lock);
         free(subpath);
         free(name);
-        return -errno;
+        return r;
     }
-    if (fi != NULL) fi->fh = fh;
-
     file->dirty = 1;
     file->cached = 1;
+    if (fi == NULL) {
+        close(fd);
+        cache_admit(ctx, file);
+    }
+    else {
+        fh = dgp_handle_new(ctx, fd, file);
+        if (fh == NULL) {
+            close(fd);
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            free(subpath);
+            free(name);
+            return -ENOMEM;
+        }
+        fh->written = 1;
+        fi->fh = (uintptr_t)fh;
+        dgp_set_open_cache(ctx, file, fi);
+    }
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    invalidate_path(ctx, subpath);
 
     free(subpath);
     free(name);
@@ -741,66 +2743,111 @@ static int dgp_open(const char *path, struct fuse_file_info *fi)
 {
     c_folder *folder;
     c_file *file;
-    int r, index;
+    dgp_handle *fh;
+    uint64_t ino;
+    int r, fd, index;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
     //Handled by dgp_create()
     if (fi->flags & O_CREAT) return -EINVAL;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index == -1) return -EISDIR;
+    r = dgp_wait_tree(ctx, ctx->opts.load_timeout);
+    if (r != 0) return r;
 
-    file = folder->files[index];
-    if (!file->cached && file_cache_fault(file) == -1) return -EIO;
-    
-    if (fi->flags & O_APPEND || fi->flags & O_CREAT || fi->flags & O_TRUNC || fi->flags & O_RDWR || fi->flags & O_WRONLY)
-        file->dirty = 1;
+    //The download only holds the lock of this file, other lookups and reads go on meanwhile
+    //A background download of the file is waited for without the tree lock, then the path is resolved again
+    while (1) {
+        folder = lock_path(path, &index, ctx, 0, 0);
+        if (folder == NULL) {
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            return -ENOENT;
+        }
+        if (index == -1) {
+            pthread_rwlock_unlock(&ctx->tree_lock);
+            return -EISDIR;
+        }
+
+        file = folder->files[index];
+        pthread_mutex_lock(&file->lock);
+        r = dgp_open_cache(ctx, file, fi->flags);
+        if (r != 1) break;
+        ino = file->ino;
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        dgp_stream_wait(ctx, ino);
+    }
+    if (r == -1) {
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -EIO;
+    }
 
-    fi->fh = open(file->cache_path, fi->flags);
-    if (fi->fh == -1) {
+    //Opening for writing leaves the file clean, the first write or truncation through the handle makes it dirty
+    fd = open(file->cache_path, fi->flags);
+    if (fd == -1) {
         perror("open()");
-        return -errno;
+        r = -errno;
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return r;
+    }
+    fh = dgp_handle_new(ctx, fd, file);
+    if (fh == NULL) {
+        close(fd);
+        pthread_mutex_unlock(&file->lock);
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOMEM;
     }
+    fi->fh = (uintptr_t)fh;
+    dgp_set_open_cache(ctx, file, fi);
+    pthread_mutex_unlock(&file->lock);
+    dgp_seq_open(ctx, file);
+    pthread_rwlock_unlock(&ctx->tree_lock);
 
     if (fi->flags & O_TRUNC) return dgp_truncate(path, 0, fi);
 
     return 0;
 }
 
-static int dgp_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+/*
+The reply references the cached copy, libfuse splices it to the kernel when it can
+Missing blocks of a sparse copy are fetched first, or the download of the copy is waited for
+*/
+static int dgp_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi)
 {
+    struct fuse_bufvec *src;
+    dgp_ctx *ctx = (dgp_ctx*)fuse_get_context()->private_data;
     int r;
 
-    if (fi == NULL) {
-        r = dgp_open(path, fi);
-        if (r != 0) return r;
-    }
+    r = dgp_read_ready(ctx, DGP_HANDLE(fi), offset, size);
+    if (r != 0) return r;
 
-    r = pread(fi->fh, buf, size, offset);
-    if (r == -1) {
-        perror("pread()");
-        return -errno;
+    src = malloc(sizeof(struct fuse_bufvec));
+    if (src == NULL) {
+        perror("malloc()");
+        return -ENOMEM;
     }
 
-    return r;
+    dgp_fd_bufvec(src, DGP_HANDLE(fi)->fd, size, offset);
+    *bufp = src;
+
+    return 0;
 }
 
-static int dgp_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+static int dgp_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset, struct fuse_file_info *fi)
 {
-    int r;
+    struct fuse_bufvec dst;
+    ssize_t r;
 
-    if (fi == NULL) {
-        r = dgp_open(path, fi);
-        if (r != 0) return r;
-    }
+    //The file is dirty before the copy changes, so that no writer opening meanwhile hashes it as the document
+    //An fsync() may have left the file clean since the last write through this handle
+    dgp_handle_written((dgp_ctx*)fuse_get_context()->private_data, DGP_HANDLE(fi));
 
-    r = pwrite(fi->fh, buf, size, offset);
-    if (r == -1) {
-        perror("pwrite()");
-        return -errno;
-    }
+    dgp_fd_bufvec(&dst, DGP_HANDLE(fi)->fd, fuse_buf_size(buf), offset);
+
+    r = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+    if (r < 0) fprintf(stderr, "fuse_buf_copy(): %s\n", strerror(-r));
 
     return r;
 }
@@ -814,33 +2861,65 @@ static int dgp_fsync(const char *path, int isdatasync, struct fuse_file_info *fi
 {
     c_folder *folder;
     c_file *file;
-    int index;
+    int index, r;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index == -1) return -EISDIR;
+    folder = lock_path(path, &index, ctx, 1, 0);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -ENOENT;
+    }
+    if (index == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        return -EISDIR;
+    }
 
     file = folder->files[index];
+    r = dgp_internal_fsync(ctx, folder, file);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+    if (r == 0) invalidate_path(ctx, path);
 
-    return dgp_internal_fsync(folder, file);
+    return r;
 }
 
 static int dgp_release(const char *path, struct fuse_file_info *fi)
 {
     c_folder *folder;
     c_file *file;
+    uint64_t ino;
     int index;
+    char dirty;
     struct fuse_context *fctx = fuse_get_context();
     dgp_ctx *ctx = (dgp_ctx*)fctx->private_data;
 
-    folder = resolve_path(path, &index, ctx);
-    if (folder == NULL) return -ENOENT;
-    if (index == -1) return -EISDIR;
-    if (folder->files[index]->dirty) dgp_fsync(path, 1, fi);
+    folder = lock_path(path, &index, ctx, 0, 0);
+    if (folder == NULL) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        dgp_handle_free(ctx, DGP_HANDLE(fi));
+        return -ENOENT;
+    }
+    if (index == -1) {
+        pthread_rwlock_unlock(&ctx->tree_lock);
+        dgp_handle_free(ctx, DGP_HANDLE(fi));
+        return -EISDIR;
+    }
+    //Handles that changed the copy upload it, an fsync() since may have left the file clean
+    //The last one also uploads changes left over, e.g. by an upload postponed while the file was open
+    file = folder->files[index];
+    dirty = DGP_HANDLE(fi)->written;
+    pthread_mutex_lock(&file->lock);
+    if (dirty) file->dirty = 1;
+    else dirty = file->dirty && file->opens == 1;
+    pthread_mutex_unlock(&file->lock);
+    pthread_rwlock_unlock(&ctx->tree_lock);
+
+    //With write-back, the upload is queued once the handle no longer holds the file open
+    ino = DGP_HANDLE(fi)->ino;
+    if (dirty && !ctx->opts.writeback) dgp_fsync(path, 1, fi);
 
-    close(fi->fh);
+    dgp_handle_free(ctx, DGP_HANDLE(fi));
+    if (dirty && ctx->opts.writeback) dgp_writeback_queue(ctx, ino);
 
     return 0;
 }
@@ -854,7 +2933,7 @@ static off_t dgp_lseek(const char *path, off_t off, int whence, struct fuse_file
         if (r != 0) return r;
     }
 
-    r = lseek(fi->fh, off, whence);
+    r = lseek(DGP_HANDLE(fi)->fd, off, whence);
     if (r == -1) {
         perror("lseek()");
         return -errno;
@@ -880,28 +2959,93 @@ static const struct fuse_operations dgp_oper = {
     .truncate   = dgp_truncate,
     .open       = dgp_open,
     .create     = dgp_create,
-    .read       = dgp_read,
-    .write      = dgp_write,
+    .read_buf   = dgp_read_buf,
+    .write_buf  = dgp_write_buf,
     .statfs     = dgp_statfs,
     .release    = dgp_release,
     .fsync      = dgp_fsync,
     .lseek      = dgp_lseek,
 };
 
+#define DGP_OPT(t, p, v) { t, offsetof(dgp_opts, p), v }
+
+static const struct fuse_opt dgp_opts_spec[] = {
+    DGP_OPT("lowlevel", lowlevel, 1),
+    DGP_OPT("--lowlevel", lowlevel, 1),
+    DGP_OPT("page_cache", page_cache, 1),
+    DGP_OPT("--page-cache", page_cache, 1),
+    DGP_OPT("block_cache", block_cache, 1),
+    DGP_OPT("--block-cache", block_cache, 1),
+    DGP_OPT("block_size=%u", block_size, 0),
+    DGP_OPT("sync_download", sync_download, 1),
+    DGP_OPT("cache_dir=%s", cache_dir, 0),
+    DGP_OPT("cache_max_bytes=%lu", cache_max_bytes, 0),
+    DGP_OPT("cache_max_files=%d", cache_max_files, 0),
+    DGP_OPT("snapshot_interval=%d", snapshot_interval, 0),
+    DGP_OPT("load_timeout=%d", load_timeout, 0),
+    DGP_OPT("writeback", writeback, 1),
+    DGP_OPT("writeback_delay=%d", writeback_delay, 0),
+    DGP_OPT("prefetch_depth=%d", prefetch_depth, 0),
+    DGP_OPT("prefetch_threads=%d", prefetch_threads, 0),
+    DGP_OPT("seq_prefetch_files=%d", seq_prefetch_files, 0),
+    DGP_OPT("seq_prefetch_bytes=%lu", seq_prefetch_bytes, 0),
+    DGP_OPT("folder_ttl=%lf", folder_ttl, 0),
+    DGP_OPT("file_ttl=%lf", file_ttl, 0),
+    DGP_OPT("negative_ttl=%lf", negative_ttl, 0),
+    FUSE_OPT_END
+};
+
 int main(int argc, char *argv[])
 {
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
     dgp_ctx *ctx;
+    int r;
 
-    ctx = malloc(sizeof(dgp_ctx));
-    if (ctx == NULL) {
-        perror("malloc()");
-        return -errno;
+    ctx = dgp_ctx_new();
+    if (ctx == NULL) return -ENOMEM;
+
+    if (fuse_opt_parse(&args, &ctx->opts, dgp_opts_spec, NULL) == -1) {
+        dgp_ctx_free(ctx);
+        return 1;
     }
-    ctx->dgp_root = NULL;
-    ctx->root_loaded = 0;
+    if (ctx->opts.block_size == 0) {
+        fputs("block_size must be greater than 0\n", stderr);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (ctx->opts.prefetch_threads <= 0) {
+        fputs("prefetch_threads must be greater than 0\n", stderr);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (ctx->opts.cache_dir != NULL && dgp_set_cache_dir(ctx, ctx->opts.cache_dir) == -1) {
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (ctx->opts.cache_max_files < 0) {
+        fputs("cache_max_files must not be negative\n", stderr);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (ctx->opts.load_timeout < 0) {
+        fputs("load_timeout must not be negative\n", stderr);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    if (ctx->opts.writeback_delay < 0) {
+        fputs("writeback_delay must not be negative\n", stderr);
+        dgp_ctx_free(ctx);
+        return 1;
+    }
+    ctx->lru.max_bytes = ctx->opts.cache_max_bytes;
+    ctx->lru.max_files = ctx->opts.cache_max_files;
 
     umask(0);
 
-    return fuse_main(argc, argv, &dgp_oper, ctx);
-}
+    if (ctx->opts.lowlevel) r = dgp_ll_main(&args, ctx);
+    else r = fuse_main(args.argc, args.argv, &dgp_oper, ctx);
+
+    fuse_opt_free_args(&args);
 
+    return r;
+}
@@ -17,21 +17,351 @@
 #include <errno.h>
 #include <time.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <pthread.h>
 #ifdef HAVE_SETXATTR
 #include <sys/xattr.h>
 #endif
 
 #include "digiposte_api.h"
 #include "data_structures.h"
+#include "path_cache.h"
+#include "notify.h"
+#include "prefetch.h"
+#include "manifest.h"
+#include "cache_lru.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "writeback.h"
+#include "content_hash.h"
 
 #ifndef DGP_FUSE_H
 #define DGP_FUSE_H
 
 #define CACHE_PATH "/tmp/.cache-dgp-fuse/"
+//Longest cache_dir accepted, so that the paths of the cached copies fit into the requests to the API
+#define DGP_CACHE_DIR_MAX 1024
+//Default seconds between two snapshots of the tree
+#define DGP_DEFAULT_SNAPSHOT_INTERVAL 300
+//Default seconds a request waits for the tree while it is loaded in the background
+#define DGP_DEFAULT_LOAD_TIMEOUT 10
+//Default seconds a written file must be left alone before write-back uploads it
+#define DGP_DEFAULT_WRITEBACK_DELAY 5
+//Default seconds the kernel may keep entries and attributes of folders and files, e.g. those returned by readdirplus
+#define DGP_DEFAULT_TTL 1.0
+//Default size of the blocks fetched on demand by the block cache
+#define DGP_DEFAULT_BLOCK_SIZE (1024*1024)
+//Default bytes of the next files of a folder downloaded ahead of sequential opens
+#define DGP_DEFAULT_SEQ_PREFETCH_BYTES (64UL*1024*1024)
 
+/*
+folder_ttl, file_ttl and negative_ttl are the seconds the kernel may keep entries and attributes of
+folders, of files, and the absence of an entry
+The path-based backend cannot tell them apart and uses the lowest of folder_ttl and file_ttl
+With page_cache, reads go through the kernel page cache instead of direct I/O
+With block_cache, files opened read-only are fetched by blocks of block_size bytes as they are read
+Otherwise they are downloaded in the background and reads wait for their range, unless sync_download is set
+With prefetch_depth, listing a folder loads the listings of its child folders down to that many levels,
+from prefetch_threads background threads
+With seq_prefetch_files, opening files of a folder one after another downloads up to that many next files ahead,
+without going over seq_prefetch_bytes
+With cache_dir, cached copies are kept there across mounts instead of CACHE_PATH, which is emptied on unmount
+cache_max_bytes and cache_max_files bound the cached copies, the least recently used closed ones are evicted beyond, 0 means no bound
+With cache_dir, a snapshot of the tree is also kept there, written on unmount and every snapshot_interval seconds, 0 to only write it on unmount
+Requests wait at most load_timeout seconds for the tree while it is loaded in the background
+With writeback, closing a written file queues its upload, run once it is left alone for writeback_delay seconds,
+instead of uploading it before the close returns
+*/
+typedef struct dgp_opts {
+    int lowlevel;
+    int page_cache;
+    int block_cache;
+    unsigned int block_size;
+    int sync_download;
+    char *cache_dir;
+    unsigned long cache_max_bytes;
+    int cache_max_files;
+    int snapshot_interval;
+    int load_timeout;
+    int writeback;
+    int writeback_delay;
+    int prefetch_depth;
+    int prefetch_threads;
+    int seq_prefetch_files;
+    unsigned long seq_prefetch_bytes;
+    double folder_ttl;
+    double file_ttl;
+    double negative_ttl;
+} dgp_opts;
+
+/*
+tree_lock guards the tree: lookups take it for reading, namespace and size changes for writing
+getattr and readdir first try without it, from the folder listings published under epochs
+seq_lock guards the sequential open hints of the folders, it may be taken with the tree lock held for reading
+cache_dir is the directory of the cached copies, ending with a slash, and manifest_path the manifest kept there with opts.cache_dir
+lru orders the files holding a cached copy for eviction
+from_snapshot is set when the tree was loaded from snapshot_path, the snapshots worker then revalidates it
+The tree is loaded by load_thread: root_loaded is set once dgp_root can be used, load_failed if it cannot,
+both under load_lock and signaled through load_cond
+uploads queues the write-back uploads, journal_path records them so that they survive a crash, journal_lock serializes its writes
+streams counts the background downloads running, under stream_lock and signaled through stream_cond,
+streams_stop tells them to end early and new ones not to start
+*/
 typedef struct dgp_ctx {
     c_folder *dgp_root;
     char root_loaded;
+    char load_failed;
+    char load_running;
+    pthread_t load_thread;
+    pthread_mutex_t load_lock;
+    pthread_cond_t load_cond;
+    void (*load_error)(void *arg);
+    void *load_error_arg;
+    pthread_rwlock_t tree_lock;
+    path_cache paths;
+    notifier notify;
+    prefetcher prefetch;
+    prefetcher seq_prefetch;
+    pthread_mutex_t seq_lock;
+    char *cache_dir;
+    char *manifest_path;
+    manifest cache_manifest;
+    cache_lru lru;
+    char *snapshot_path;
+    char from_snapshot;
+    snapshot_worker snapshots;
+    writeback uploads;
+    char *journal_path;
+    pthread_mutex_t journal_lock;
+    int streams;
+    char streams_stop;
+    pthread_mutex_t stream_lock;
+    pthread_cond_t stream_cond;
+    dgp_opts opts;
 } dgp_ctx;
 
+/*
+Open file handle, stored into the fh field of struct fuse_file_info
+partial is set while the cached copy behind fd is sparse or being downloaded, reads must then go through dgp_read_ready()
+written is set once the copy was written or truncated through the handle, only then does its release upload the file
+*/
+typedef struct dgp_handle {
+    int fd;
+    char partial;
+    char written;
+    uint64_t ino;
+} dgp_handle;
+
+#define DGP_HANDLE(fi) ((dgp_handle*)(uintptr_t)(fi)->fh)
+
+/*
+Fetch the content list of folder from the API
+Must be called with the tree lock held for writing
+Return 0 on success, -1 otherwise
+*/
+int folder_cache_fault(c_folder *folder);
+
+/*
+Start the prefetcher if prefetch_depth is set, and the one of sequential opens if seq_prefetch_files is set
+Return 0 on success, -1 otherwise
+*/
+int dgp_prefetch_start(dgp_ctx *ctx);
+
+/*
+Start the snapshots worker if cache_dir is set: it revalidates a tree loaded from a snapshot, then writes snapshots periodically
+Must be called once the tree is loaded
+Return 0 on success, -1 otherwise
+*/
+int dgp_snapshot_start(dgp_ctx *ctx);
+
+/*
+Start the write-back uploader if writeback is set
+Return 0 on success, -1 otherwise
+*/
+int dgp_writeback_start(dgp_ctx *ctx);
+
+/*
+Queue the upload of the file of inode ino, or postpone it, and record it into the journal
+Takes the tree lock for reading, so it must not be held by the caller
+*/
+void dgp_writeback_queue(dgp_ctx *ctx, const uint64_t ino);
+
+/*
+Queue the child folders found in the listing meta for loading in the background
+Only the first request of a listing should call it, e.g. at offset 0
+*/
+void dgp_prefetch_children(dgp_ctx *ctx, const c_meta *meta);
+
+/*
+Record that file is being opened and queue the download of its next siblings
+when the files of its folder are opened one after another, or cancel the ones queued if that run breaks
+Must be called with the tree lock held, but not the lock of file
+*/
+void dgp_seq_open(dgp_ctx *ctx, const c_file *file);
+
+/*
+Fetch the content list of the folder of inode ino if it is not loaded yet
+Takes the tree lock for writing, so it must not be held by the caller
+Return 0 on success or if the folder is gone, -1 otherwise
+*/
+int dgp_load_folder(dgp_ctx *ctx, const uint64_t ino);
+
+/*
+Download file into the cache directory and set its cache_path
+Must be called with the tree lock held and the lock of file
+Return 0 on success, -1 otherwise
+*/
+int file_cache_fault(dgp_ctx *ctx, c_file *file);
+
+/*
+Make the cached copy of file ready to be opened with flags
+A copy left by a former mount is reused if the manifest still matches the document
+A read-only open only creates a sparse copy with the block cache, or starts a background download otherwise
+Other opens wait for the whole file to be downloaded, and hash it while it still holds the content of the document
+Must be called with the tree lock held and the lock of file, unless the tree lock is held for writing
+Return 0 on success, 1 if a background download of file must first be waited for with dgp_stream_wait(), -1 otherwise
+*/
+int dgp_open_cache(dgp_ctx *ctx, c_file *file, const int flags);
+
+/*
+Wait for the background download of the file of inode ino to end or progress, without holding the tree lock meanwhile
+Takes the tree lock for reading, so it must not be held by the caller
+Return 1 if the file was being downloaded, 0 otherwise
+*/
+int dgp_stream_wait(dgp_ctx *ctx, const uint64_t ino);
+
+/*
+Allocate a handle for the cached copy of file opened as fd
+The copy then counts as the most recently used one and cannot be evicted until its handles are released
+Must be called with the tree lock held and the lock of file
+Return NULL on error
+*/
+dgp_handle* dgp_handle_new(dgp_ctx *ctx, const int fd, c_file *file);
+
+/*
+Close the cached copy behind fh and release it, then evict cached copies if the cache is over its bounds
+Takes the tree lock for reading, so it must not be held by the caller
+*/
+void dgp_handle_free(dgp_ctx *ctx, dgp_handle *fh);
+
+/*
+Mark file as changed from its document, its manifest entry is set aside until the file is clean again
+Must be called with the lock of file held, unless the tree lock is held for writing
+*/
+void dgp_file_dirty(dgp_ctx *ctx, c_file *file);
+
+/*
+Record that the copy is about to be written through fh, its file is then dirty
+Called on every write, as an fsync() leaves the file clean while fh is still open
+Takes the tree lock for reading, so it must not be held by the caller
+*/
+void dgp_handle_written(dgp_ctx *ctx, dgp_handle *fh);
+
+/*
+Fetch the missing blocks covering size bytes at off before they are read through fh,
+or wait for them to be downloaded
+Takes the tree lock for reading, so it must not be held by the caller
+Return 0 on success, -EIO otherwise
+*/
+int dgp_read_ready(dgp_ctx *ctx, dgp_handle *fh, const off_t off, const size_t size);
+
+/*
+Set the caching mode of a file being opened: direct I/O, or the page cache kept across opens
+while the cached copy is unchanged since the kernel last read it
+Must be called with the lock of file held, once its cached copy is opened
+*/
+void dgp_set_open_cache(const dgp_ctx *ctx, c_file *file, struct fuse_file_info *fi);
+
+/*
+Ask for splice() transfers between the kernel and the cached copies, when the kernel supports them
+*/
+void dgp_want_splice(struct fuse_conn_info *conn);
+
+/*
+Set bufv to a single buffer of size bytes at offset off of the cached copy opened as fd
+The data is then moved by fuse_buf_copy() or fuse_reply_data() without going through a buffer of the daemon
+*/
+void dgp_fd_bufvec(struct fuse_bufvec *bufv, const int fd, const size_t size, const off_t off);
+
+/*
+Upload file if it is cached and dirty, replacing the remote document
+A copy whose content hash matches the one of the document is not sent again
+Must be called with the tree lock held for writing
+Return 0 on success, -errno otherwise
+*/
+int dgp_internal_fsync(dgp_ctx *ctx, c_folder *parent, c_file *file);
+
+/*
+Start the API subsystem, load the folders tree, from the snapshot if there is one, create the cache directory and load its manifest
+The files of the journal left by a former mount are marked to be uploaded again
+Nothing is left loaded on failure
+Return 0 on success, -1 otherwise
+*/
+int dgp_load(dgp_ctx *ctx);
+
+/*
+Load the tree with dgp_load() from a background thread, then start the snapshots worker
+and make the kernel drop the view of the root it was given meanwhile
+error(arg) is called from that thread if the loading fails, to end the session
+Return 0 on success, -1 otherwise
+*/
+int dgp_load_start(dgp_ctx *ctx, void (*error)(void *arg), void *arg);
+
+/*
+Wait for the thread started by dgp_load_start() to end, does nothing if it is not running
+*/
+void dgp_load_join(dgp_ctx *ctx);
+
+/*
+Wait at most timeout seconds for the tree to be loaded, 0 only checks it
+Return 0 once it is loaded, -EAGAIN if it is still loading, -EIO if its loading failed
+*/
+int dgp_wait_tree(dgp_ctx *ctx, const int timeout);
+
+/*
+Fill stbuf for the root folder while the tree is still loading, as an empty folder
+*/
+void dgp_fill_stat_root(struct stat *stbuf, const uid_t uid, const gid_t gid);
+
+/*
+Sync dirty files, free the tree, stop the API subsystem and empty the cache directory
+A persistent cache directory only loses the copies missing from its manifest, which is saved along with a snapshot of the tree
+Files that could not be uploaded are recorded into the journal and keep their copy
+Does nothing if the tree was not loaded
+*/
+void dgp_unload(dgp_ctx *ctx);
+
+/*
+Set the directory of the cached copies, dir must be an absolute path
+Return 0 on success, -1 otherwise
+*/
+int dgp_set_cache_dir(dgp_ctx *ctx, const char *dir);
+
+/*
+Allocate a context with its locks, an empty path cache, a stopped notifier and prefetchers and default options
+Return NULL on error
+*/
+dgp_ctx* dgp_ctx_new();
+
+/*
+Release a context allocated by dgp_ctx_new(), the tree must be unloaded
+*/
+void dgp_ctx_free(dgp_ctx *ctx);
+
+/*
+Fill stbuf for folder, or for file if it is not NULL
+*/
+void dgp_fill_stat(struct stat *stbuf, const c_folder *folder, const c_file *file, const uid_t uid, const gid_t gid);
+
+/*
+Fill stbuf from an entry of a compact folder listing
+*/
+void dgp_fill_stat_entry(struct stat *stbuf, const c_meta_entry *entry, const uid_t uid, const gid_t gid);
+
+/*
+Run the daemon with the low-level (inode based) FUSE API
+Return the exit status of the session
+*/
+int dgp_ll_main(struct fuse_args *args, dgp_ctx *ctx);
+
 #endif
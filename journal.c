@@ -0,0 +1,130 @@
+/* For fsync() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "journal.h"
+
+#define JOURNAL_HEADER "dgp-journal 1\n"
+
+int journal_save(const char *path, const journal_entry *entries, const int nb)
+{
+    FILE *f;
+    char *tmp_path;
+    size_t path_len;
+    int i, r = 0;
+
+    if (nb == 0) {
+        if (unlink(path) == -1 && errno != ENOENT) {
+            perror("unlink()");
+            return -1;
+        }
+        return 0;
+    }
+
+    path_len = strlen(path);
+    tmp_path = malloc(path_len+5);
+    if (tmp_path == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path+path_len, ".tmp", 5);
+
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        perror("fopen()");
+        free(tmp_path);
+        return -1;
+    }
+
+    //Each line is the id of a copy, the id of its folder and its name, separated by tabs
+    fputs(JOURNAL_HEADER, f);
+    for (i=0; i<nb; i++) {
+        if (strchr(entries[i].name, '\n') != NULL) continue;
+        fprintf(f, "%.32s\t%.32s\t%s\n", entries[i].id, entries[i].folder_id, entries[i].name);
+    }
+
+    //The journal is only worth something once it is on the disk
+    if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        perror("fsync()");
+        r = -1;
+    }
+    if (fclose(f) != 0) {
+        perror("fclose()");
+        r = -1;
+    }
+    if (r == 0 && rename(tmp_path, path) != 0) {
+        perror("rename()");
+        r = -1;
+    }
+    if (r == -1) unlink(tmp_path);
+    free(tmp_path);
+
+    return r;
+}
+
+journal_entry* journal_load(const char *path, int *nb)
+{
+    FILE *f;
+    journal_entry *entries, *tmp;
+    char line[32+1+32+1+4096+2];
+    size_t len;
+    int capacity;
+
+    *nb = 0;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        if (errno != ENOENT) perror("fopen()");
+        return NULL;
+    }
+
+    if (fgets(line, sizeof(line), f) == NULL || strcmp(line, JOURNAL_HEADER) != 0) {
+        fprintf(stderr, "journal_load(): %s is not a journal\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    entries = NULL;
+    capacity = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        len = strlen(line);
+        if (len < 67 || line[len-1] != '\n' || line[32] != '\t' || line[65] != '\t') continue;
+        line[len-1] = '\0';
+
+        if (*nb == capacity) {
+            capacity = capacity == 0 ? 16 : capacity*2;
+            tmp = realloc(entries, capacity * sizeof(journal_entry));
+            if (tmp == NULL) {
+                perror("realloc()");
+                break;
+            }
+            entries = tmp;
+        }
+
+        entries[*nb].name = malloc(len-66);
+        if (entries[*nb].name == NULL) {
+            perror("malloc()");
+            break;
+        }
+        memcpy(entries[*nb].id, line, 32);
+        memcpy(entries[*nb].folder_id, line+33, 32);
+        memcpy(entries[*nb].name, line+66, len-66);
+        (*nb)++;
+    }
+    fclose(f);
+
+    if (*nb == 0) {
+        free(entries);
+        return NULL;
+    }
+
+    return entries;
+}
+
+void journal_free(journal_entry *entries, const int nb)
+{
+    int i;
+
+    for (i=0; i<nb; i++) free(entries[i].name);
+    free(entries);
+}
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#ifndef DGP_JOURNAL_H
+#define DGP_JOURNAL_H
+
+#define JOURNAL_NAME "journal"
+
+/*
+File whose cached copy holds changes not uploaded yet
+id names the cached copy, folder_id and name tell where to upload it if the document is gone
+*/
+typedef struct journal_entry {
+    char id[32];
+    char folder_id[32];
+    char *name;
+} journal_entry;
+
+/*
+Write the nb entries to path, replacing it at once once they reach the disk
+With no entry, path is removed
+Return 0 on success, -1 otherwise
+*/
+int journal_save(const char *path, const journal_entry *entries, const int nb);
+
+/*
+Read the entries written to path
+Return them and set nb to their number, return NULL with nb set to 0 if there is no journal or on error
+*/
+journal_entry* journal_load(const char *path, int *nb);
+
+/*
+Release nb entries returned by journal_load(), or built the same way with allocated names
+*/
+void journal_free(journal_entry *entries, const int nb);
+
+#endif
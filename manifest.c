@@ -0,0 +1,340 @@
+#include "manifest.h"
+
+#define MANIFEST_HEADER "dgp-manifest 1\n"
+
+static unsigned int hash_id(const char *id)
+{
+    unsigned int hash = 2166136261u;
+    int i;
+
+    for (i=0; i<32; i++) {
+        hash ^= (unsigned char)id[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+Return the slot of id, or the empty slot where it would go
+The table must have at least one empty slot
+*/
+static int manifest_slot(const manifest *m, const char *id)
+{
+    int i, mask;
+
+    mask = m->capacity-1;
+    i = hash_id(id) & mask;
+    while (m->entries[i].id[0] != '\0' && memcmp(m->entries[i].id, id, 32) != 0) i = (i+1) & mask;
+
+    return i;
+}
+
+static int manifest_grow(manifest *m)
+{
+    manifest_entry *old;
+    int i, old_capacity;
+
+    old = m->entries;
+    old_capacity = m->capacity;
+
+    m->capacity = old_capacity == 0 ? 64 : old_capacity*2;
+    m->entries = calloc(m->capacity, sizeof(manifest_entry));
+    if (m->entries == NULL) {
+        perror("calloc()");
+        m->entries = old;
+        m->capacity = old_capacity;
+        return -1;
+    }
+
+    for (i=0; i<old_capacity; i++) {
+        if (old[i].id[0] != '\0') memcpy(&m->entries[manifest_slot(m, old[i].id)], &old[i], sizeof(manifest_entry));
+    }
+    free(old);
+
+    return 0;
+}
+
+static void manifest_unidle(manifest *m, manifest_entry *entry)
+{
+    if (!entry->idle) return;
+    entry->idle = 0;
+    m->idle_bytes -= entry->size;
+    m->idle_files--;
+}
+
+static int manifest_set_locked(manifest *m, const char *id, const size_t size, const char *etag, const char idle)
+{
+    manifest_entry *entry;
+    size_t etag_len;
+
+    etag_len = strlen(etag);
+    if (etag_len >= DGP_ETAG_SIZE) etag_len = 0;
+
+    if ((m->count+1)*4 > m->capacity*3 && manifest_grow(m) == -1) return -1;
+
+    entry = &m->entries[manifest_slot(m, id)];
+    if (entry->id[0] == '\0') m->count++;
+    else manifest_unidle(m, entry);
+    memcpy(entry->id, id, 32);
+    entry->size = size;
+    memcpy(entry->etag, etag, etag_len);
+    entry->etag[etag_len] = '\0';
+    entry->suspended = 0;
+    entry->idle = idle;
+    if (idle) {
+        m->idle_bytes += size;
+        m->idle_files++;
+    }
+
+    return 0;
+}
+
+void manifest_init(manifest *m)
+{
+    memset(m, 0, sizeof(manifest));
+    pthread_mutex_init(&m->lock, NULL);
+}
+
+int manifest_load(manifest *m, const char *path)
+{
+    FILE *f;
+    char line[32+1+20+1+DGP_ETAG_SIZE+1], *ptr, *end;
+    unsigned long long size;
+    size_t len;
+
+    f = fopen(path, "r");
+    if (f == NULL) return errno == ENOENT ? 0 : -1;
+
+    if (fgets(line, sizeof(line), f) == NULL || strcmp(line, MANIFEST_HEADER) != 0) {
+        fprintf(stderr, "manifest_load(): %s is not a manifest\n", path);
+        fclose(f);
+        return -1;
+    }
+
+    pthread_mutex_lock(&m->lock);
+    //Each line is the id, the size and the etag of a copy, separated by tabs
+    while (fgets(line, sizeof(line), f) != NULL) {
+        len = strlen(line);
+        if (len < 35 || line[len-1] != '\n' || line[32] != '\t') continue;
+        line[len-1] = '\0';
+
+        size = strtoull(line+33, &end, 10);
+        if (end == line+33 || *end != '\t') continue;
+        ptr = end+1;
+
+        manifest_set_locked(m, line, size, ptr, 1);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    fclose(f);
+
+    return 0;
+}
+
+int manifest_save(manifest *m, const char *path)
+{
+    FILE *f;
+    char *tmp_path;
+    size_t path_len;
+    int i, r = 0;
+
+    path_len = strlen(path);
+    tmp_path = malloc(path_len+5);
+    if (tmp_path == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path+path_len, ".tmp", 5);
+
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        perror("fopen()");
+        free(tmp_path);
+        return -1;
+    }
+
+    fputs(MANIFEST_HEADER, f);
+    pthread_mutex_lock(&m->lock);
+    for (i=0; i<m->capacity; i++) {
+        if (m->entries[i].id[0] == '\0' || m->entries[i].suspended) continue;
+        fprintf(f, "%.32s\t%llu\t%s\n", m->entries[i].id, (unsigned long long)m->entries[i].size, m->entries[i].etag);
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    if (fclose(f) != 0) {
+        perror("fclose()");
+        r = -1;
+    }
+    if (r == 0 && rename(tmp_path, path) != 0) {
+        perror("rename()");
+        r = -1;
+    }
+    if (r == -1) unlink(tmp_path);
+    free(tmp_path);
+
+    return r;
+}
+
+int manifest_lookup(manifest *m, const char *id, size_t *size, char *etag)
+{
+    const manifest_entry *entry;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->count == 0) {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+
+    entry = &m->entries[manifest_slot(m, id)];
+    if (entry->id[0] == '\0' || entry->suspended) {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+
+    if (size != NULL) *size = entry->size;
+    if (etag != NULL) memcpy(etag, entry->etag, strlen(entry->etag)+1);
+    pthread_mutex_unlock(&m->lock);
+
+    return 0;
+}
+
+int manifest_set(manifest *m, const char *id, const size_t size, const char *etag)
+{
+    int r;
+
+    pthread_mutex_lock(&m->lock);
+    r = manifest_set_locked(m, id, size, etag, 0);
+    pthread_mutex_unlock(&m->lock);
+
+    return r;
+}
+
+/*
+Empty slot i, which holds an entry
+*/
+static void manifest_remove_slot(manifest *m, int i)
+{
+    int j, k, mask;
+
+    manifest_unidle(m, &m->entries[i]);
+
+    //Shift back the following entries of the probe sequence that may no longer be reached
+    mask = m->capacity-1;
+    j = i;
+    while (1) {
+        m->entries[i].id[0] = '\0';
+        do {
+            j = (j+1) & mask;
+            if (m->entries[j].id[0] == '\0') {
+                m->count--;
+                return;
+            }
+            k = hash_id(m->entries[j].id) & mask;
+        } while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+        memcpy(&m->entries[i], &m->entries[j], sizeof(manifest_entry));
+        i = j;
+    }
+}
+
+void manifest_remove(manifest *m, const char *id)
+{
+    int i;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->count > 0) {
+        i = manifest_slot(m, id);
+        if (m->entries[i].id[0] != '\0') manifest_remove_slot(m, i);
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+/*
+Set the suspended mark of the entry of the document id, if any
+*/
+static void manifest_mark(manifest *m, const char *id, const char suspended)
+{
+    int i;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->count > 0) {
+        i = manifest_slot(m, id);
+        if (m->entries[i].id[0] != '\0') {
+            manifest_unidle(m, &m->entries[i]);
+            m->entries[i].suspended = suspended;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+}
+
+void manifest_suspend(manifest *m, const char *id)
+{
+    manifest_mark(m, id, 1);
+}
+
+void manifest_resume(manifest *m, const char *id)
+{
+    manifest_mark(m, id, 0);
+}
+
+int manifest_claim(manifest *m, const char *id, size_t *size, char *etag)
+{
+    manifest_entry *entry;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->count == 0) {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+
+    entry = &m->entries[manifest_slot(m, id)];
+    if (entry->id[0] == '\0' || entry->suspended) {
+        pthread_mutex_unlock(&m->lock);
+        return -1;
+    }
+    manifest_unidle(m, entry);
+    if (size != NULL) *size = entry->size;
+    if (etag != NULL) memcpy(etag, entry->etag, strlen(entry->etag)+1);
+    pthread_mutex_unlock(&m->lock);
+
+    return 0;
+}
+
+void manifest_idle(manifest *m, uint64_t *bytes, int *files)
+{
+    pthread_mutex_lock(&m->lock);
+    *bytes = m->idle_bytes;
+    *files = m->idle_files;
+    pthread_mutex_unlock(&m->lock);
+}
+
+int manifest_pop_idle(manifest *m, char *id)
+{
+    int i;
+
+    pthread_mutex_lock(&m->lock);
+    if (m->idle_files > 0) {
+        for (i=0; i<m->capacity; i++) {
+            if (m->entries[i].id[0] == '\0' || !m->entries[i].idle) continue;
+            memcpy(id, m->entries[i].id, 32);
+            manifest_remove_slot(m, i);
+            pthread_mutex_unlock(&m->lock);
+            return 0;
+        }
+    }
+    pthread_mutex_unlock(&m->lock);
+
+    return -1;
+}
+
+void manifest_free(manifest *m)
+{
+    free(m->entries);
+    m->entries = NULL;
+    m->capacity = 0;
+    m->count = 0;
+    m->idle_bytes = 0;
+    m->idle_files = 0;
+    pthread_mutex_destroy(&m->lock);
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "digiposte_api.h"
+
+#ifndef DGP_MANIFEST_H
+#define DGP_MANIFEST_H
+
+#define MANIFEST_NAME "manifest"
+
+/*
+Cached copies kept across mounts, by document id
+A copy is reused while the document keeps its id and size, and its etag when one was recorded
+Open-addressing hash table with linear probing, an empty slot has a null first id byte
+Entries are guarded by the lock of the manifest
+An entry loaded from the disk is idle until its copy is used again, idle_bytes and idle_files add up the idle entries
+A suspended entry is kept aside while its copy differs from the document, it is neither found nor saved
+*/
+typedef struct manifest_entry {
+    char id[32];
+    size_t size;
+    char etag[DGP_ETAG_SIZE];
+    char idle;
+    char suspended;
+} manifest_entry;
+
+typedef struct manifest {
+    pthread_mutex_t lock;
+    manifest_entry *entries;
+    int capacity;
+    int count;
+    uint64_t idle_bytes;
+    int idle_files;
+} manifest;
+
+/*
+Initialize an empty manifest
+*/
+void manifest_init(manifest *m);
+
+/*
+Add the entries saved at path by manifest_save(), as idle ones
+A missing file leaves the manifest as is
+Return 0 on success, -1 otherwise
+*/
+int manifest_load(manifest *m, const char *path);
+
+/*
+Save the entries to path, replacing it at once
+Return 0 on success, -1 otherwise
+*/
+int manifest_save(manifest *m, const char *path);
+
+/*
+Look up the copy of the document id, size and etag may be NULL
+Return 0 if found, -1 otherwise
+*/
+int manifest_lookup(manifest *m, const char *id, size_t *size, char *etag);
+
+/*
+Record the copy of the document id, replacing any former entry
+Return 0 on success, -1 otherwise
+*/
+int manifest_set(manifest *m, const char *id, const size_t size, const char *etag);
+
+/*
+Forget the copy of the document id
+*/
+void manifest_remove(manifest *m, const char *id);
+
+/*
+Suspend the entry of the document id while its copy is being changed
+*/
+void manifest_suspend(manifest *m, const char *id);
+
+/*
+Trust the suspended entry of the document id again, its copy is back to the content of the document
+*/
+void manifest_resume(manifest *m, const char *id);
+
+/*
+Look up the copy of the document id like manifest_lookup() and mark it as used by this mount, it is no longer idle
+Return 0 if found, -1 otherwise
+*/
+int manifest_claim(manifest *m, const char *id, size_t *size, char *etag);
+
+/*
+Set bytes and files to the total size and the number of the idle copies
+*/
+void manifest_idle(manifest *m, uint64_t *bytes, int *files);
+
+/*
+Forget an idle copy and set id, of 32 bytes, to its document id
+Return 0 on success, -1 if no copy is idle
+*/
+int manifest_pop_idle(manifest *m, char *id);
+
+/*
+Drop every entry and release the lock of the manifest
+*/
+void manifest_free(manifest *m);
+
+#endif
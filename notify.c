@@ -0,0 +1,113 @@
+#include "notify.h"
+
+static void* notifier_run(void *arg)
+{
+    notifier *n = arg;
+    notify_item *item;
+
+    pthread_mutex_lock(&n->lock);
+    while (!n->stop) {
+        if (n->head == NULL) {
+            pthread_cond_wait(&n->cond, &n->lock);
+            continue;
+        }
+
+        item = n->head;
+        n->head = item->next;
+        if (n->head == NULL) n->tail = NULL;
+        pthread_mutex_unlock(&n->lock);
+
+        n->send(n->arg, item->ino, item->name);
+        free(item->name);
+        free(item);
+
+        pthread_mutex_lock(&n->lock);
+    }
+    pthread_mutex_unlock(&n->lock);
+
+    return NULL;
+}
+
+void notifier_init(notifier *n)
+{
+    memset(n, 0, sizeof(notifier));
+    pthread_mutex_init(&n->lock, NULL);
+    pthread_cond_init(&n->cond, NULL);
+}
+
+int notifier_start(notifier *n, void (*send)(void *arg, const uint64_t ino, const char *name), void *arg)
+{
+    n->send = send;
+    n->arg = arg;
+    n->stop = 0;
+
+    if (pthread_create(&n->thread, NULL, notifier_run, n) != 0) {
+        fputs("pthread_create(): error\n", stderr);
+        return -1;
+    }
+    n->running = 1;
+
+    return 0;
+}
+
+void notifier_push(notifier *n, const uint64_t ino, const char *name)
+{
+    notify_item *item;
+    int len;
+
+    if (!n->running) return;
+
+    item = malloc(sizeof(notify_item));
+    if (item == NULL) {
+        perror("malloc()");
+        return;
+    }
+    item->next = NULL;
+    item->ino = ino;
+    item->name = NULL;
+    if (name != NULL) {
+        len = strlen(name);
+        item->name = malloc(len+1);
+        if (item->name == NULL) {
+            perror("malloc()");
+            free(item);
+            return;
+        }
+        memcpy(item->name, name, len+1);
+    }
+
+    pthread_mutex_lock(&n->lock);
+    if (n->tail == NULL) n->head = item;
+    else n->tail->next = item;
+    n->tail = item;
+    pthread_cond_signal(&n->cond);
+    pthread_mutex_unlock(&n->lock);
+}
+
+void notifier_stop(notifier *n)
+{
+    notify_item *item;
+
+    if (n->running) {
+        pthread_mutex_lock(&n->lock);
+        n->stop = 1;
+        pthread_cond_signal(&n->cond);
+        pthread_mutex_unlock(&n->lock);
+        pthread_join(n->thread, NULL);
+        n->running = 0;
+    }
+
+    while ((item = n->head) != NULL) {
+        n->head = item->next;
+        free(item->name);
+        free(item);
+    }
+    n->tail = NULL;
+}
+
+void notifier_free(notifier *n)
+{
+    notifier_stop(n);
+    pthread_mutex_destroy(&n->lock);
+    pthread_cond_destroy(&n->cond);
+}
@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef DGP_NOTIFY_H
+#define DGP_NOTIFY_H
+
+/*
+Deferred kernel invalidations
+The kernel may hold the inode being invalidated locked until the request that changed it is answered,
+so notifications are queued by the request handlers and sent from a dedicated thread afterwards
+*/
+typedef struct notify_item {
+    struct notify_item *next;
+    uint64_t ino;
+    char *name;
+} notify_item;
+
+typedef struct notifier {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    notify_item *head;
+    notify_item *tail;
+    char running;
+    char stop;
+    void (*send)(void *arg, const uint64_t ino, const char *name);
+    void *arg;
+} notifier;
+
+/*
+Initialize a stopped notifier, pushes are ignored until it is started
+*/
+void notifier_init(notifier *n);
+
+/*
+Start the thread sending queued notifications through send(arg, ino, name)
+Return 0 on success, -1 otherwise
+*/
+int notifier_start(notifier *n, void (*send)(void *arg, const uint64_t ino, const char *name), void *arg);
+
+/*
+Queue a notification, name is copied and may be NULL
+*/
+void notifier_push(notifier *n, const uint64_t ino, const char *name);
+
+/*
+Stop the thread and drop the notifications not sent yet
+The notifier can be started again
+*/
+void notifier_stop(notifier *n);
+
+/*
+Stop the notifier if needed and release it
+*/
+void notifier_free(notifier *n);
+
+#endif
@@ -0,0 +1,118 @@
+#include "path_cache.h"
+
+static unsigned int hash_path(const char *path)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static void path_entry_clear(path_entry *entry)
+{
+    free(entry->path);
+    entry->path = NULL;
+    entry->folder = NULL;
+    entry->file = NULL;
+}
+
+static void path_cache_clear_locked(path_cache *cache)
+{
+    int i;
+
+    for (i=0; i<PATH_CACHE_SIZE; i++)
+        if (cache->entries[i].path != NULL) path_entry_clear(&cache->entries[i]);
+}
+
+void path_cache_init(path_cache *cache)
+{
+    memset(cache, 0, sizeof(path_cache));
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+int path_cache_lookup(path_cache *cache, const char *path, c_folder **folder, c_file **file)
+{
+    const path_entry *entry;
+    unsigned int hash;
+
+    hash = hash_path(path);
+    entry = &cache->entries[hash & (PATH_CACHE_SIZE-1)];
+
+    pthread_mutex_lock(&cache->lock);
+    if (entry->path == NULL || entry->hash != hash || strcmp(entry->path, path) != 0) {
+        pthread_mutex_unlock(&cache->lock);
+        return -1;
+    }
+
+    *folder = entry->folder;
+    *file = entry->file;
+    pthread_mutex_unlock(&cache->lock);
+
+    return 0;
+}
+
+void path_cache_insert(path_cache *cache, const char *path, c_folder *folder, c_file *file)
+{
+    path_entry *entry;
+    unsigned int hash;
+    char *ptr;
+    int path_len;
+
+    hash = hash_path(path);
+    entry = &cache->entries[hash & (PATH_CACHE_SIZE-1)];
+
+    path_len = strlen(path);
+    ptr = malloc(path_len+1);
+    if (ptr == NULL) {
+        perror("malloc()");
+        return;
+    }
+    memcpy(ptr, path, path_len+1);
+
+    pthread_mutex_lock(&cache->lock);
+    free(entry->path);
+    entry->hash = hash;
+    entry->path = ptr;
+    entry->folder = folder;
+    entry->file = file;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void path_cache_invalidate(path_cache *cache, const char *path)
+{
+    path_entry *entry;
+    int i, path_len;
+
+    path_len = strlen(path);
+
+    pthread_mutex_lock(&cache->lock);
+    if (path_len == 1 && path[0] == '/') {
+        path_cache_clear_locked(cache);
+        pthread_mutex_unlock(&cache->lock);
+        return;
+    }
+
+    for (i=0; i<PATH_CACHE_SIZE; i++) {
+        entry = &cache->entries[i];
+        if (entry->path == NULL || strncmp(entry->path, path, path_len) != 0) continue;
+        if (entry->path[path_len] == '\0' || entry->path[path_len] == '/') path_entry_clear(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void path_cache_clear(path_cache *cache)
+{
+    pthread_mutex_lock(&cache->lock);
+    path_cache_clear_locked(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void path_cache_free(path_cache *cache)
+{
+    path_cache_clear_locked(cache);
+    pthread_mutex_destroy(&cache->lock);
+}
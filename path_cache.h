@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include "data_structures.h"
+
+#ifndef DGP_PATH_CACHE_H
+#define DGP_PATH_CACHE_H
+
+#define PATH_CACHE_SIZE 4096
+
+/*
+Direct-mapped cache from a full path to the node it resolves to
+file is NULL when the path points to a folder
+An empty entry has a NULL path
+Entries are guarded by the lock of the cache, lookups from concurrent readers of the tree included
+*/
+typedef struct path_entry {
+    unsigned int hash;
+    char *path;
+    c_folder *folder;
+    c_file *file;
+} path_entry;
+
+typedef struct path_cache {
+    pthread_mutex_t lock;
+    path_entry entries[PATH_CACHE_SIZE];
+} path_cache;
+
+/*
+Initialize an empty path cache
+*/
+void path_cache_init(path_cache *cache);
+
+/*
+Look up path into the cache
+On hit, set folder and file and return 0
+Return -1 on miss
+*/
+int path_cache_lookup(path_cache *cache, const char *path, c_folder **folder, c_file **file);
+
+/*
+Insert path into the cache, replacing any entry sharing its bucket
+file is NULL when the path points to a folder
+*/
+void path_cache_insert(path_cache *cache, const char *path, c_folder *folder, c_file *file);
+
+/*
+Drop path and every cached path below it
+Must be called before the nodes behind these paths are moved or freed
+*/
+void path_cache_invalidate(path_cache *cache, const char *path);
+
+/*
+Drop every entry
+*/
+void path_cache_clear(path_cache *cache);
+
+/*
+Drop every entry and release the lock of the cache
+*/
+void path_cache_free(path_cache *cache);
+
+#endif
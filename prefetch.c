@@ -0,0 +1,117 @@
+#include "prefetch.h"
+
+static void* prefetcher_run(void *arg)
+{
+    prefetcher *p = arg;
+    prefetch_item item;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop) {
+        if (p->count == 0) {
+            pthread_cond_wait(&p->cond, &p->lock);
+            continue;
+        }
+
+        item = p->items[p->head];
+        p->head = (p->head + 1) % PREFETCH_QUEUE_SIZE;
+        p->count--;
+        pthread_mutex_unlock(&p->lock);
+
+        p->load(p->arg, item.ino, item.param);
+
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+void prefetcher_init(prefetcher *p)
+{
+    memset(p, 0, sizeof(prefetcher));
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+}
+
+int prefetcher_start(prefetcher *p, const int nb_threads, void (*load)(void *arg, const uint64_t ino, const int param), void *arg)
+{
+    int i;
+
+    p->threads = malloc(nb_threads * sizeof(pthread_t));
+    if (p->threads == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+    p->load = load;
+    p->arg = arg;
+    p->stop = 0;
+
+    for (i=0; i<nb_threads; i++) {
+        if (pthread_create(&p->threads[i], NULL, prefetcher_run, p) != 0) {
+            fputs("pthread_create(): error\n", stderr);
+            break;
+        }
+    }
+    pthread_mutex_lock(&p->lock);
+    p->nb_threads = i;
+    pthread_mutex_unlock(&p->lock);
+
+    if (i == 0) {
+        free(p->threads);
+        p->threads = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void prefetcher_push(prefetcher *p, const uint64_t ino, const int param)
+{
+    prefetch_item *item;
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->nb_threads == 0 || p->count == PREFETCH_QUEUE_SIZE) {
+        pthread_mutex_unlock(&p->lock);
+        return;
+    }
+    for (i=0; i<p->count; i++) {
+        item = &p->items[(p->head + i) % PREFETCH_QUEUE_SIZE];
+        if (item->ino == ino) {
+            if (item->param < param) item->param = param;
+            pthread_mutex_unlock(&p->lock);
+            return;
+        }
+    }
+
+    i = (p->head + p->count) % PREFETCH_QUEUE_SIZE;
+    p->items[i].ino = ino;
+    p->items[i].param = param;
+    p->count++;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+void prefetcher_stop(prefetcher *p)
+{
+    int i, nb_threads;
+
+    pthread_mutex_lock(&p->lock);
+    nb_threads = p->nb_threads;
+    p->nb_threads = 0;
+    p->stop = 1;
+    p->count = 0;
+    pthread_cond_broadcast(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+
+    for (i=0; i<nb_threads; i++) pthread_join(p->threads[i], NULL);
+    free(p->threads);
+    p->threads = NULL;
+}
+
+void prefetcher_free(prefetcher *p)
+{
+    prefetcher_stop(p);
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+}
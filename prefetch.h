@@ -0,0 +1,62 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifndef DGP_PREFETCH_H
+#define DGP_PREFETCH_H
+
+#define PREFETCH_QUEUE_SIZE 256
+
+/*
+Bounded queue of nodes loaded ahead of time by a few worker threads
+Each item carries a parameter given as is to the loader, e.g. the number of levels still to prefetch below a folder
+A push of a node already queued only raises its parameter, pushes beyond the size of the queue are dropped
+*/
+typedef struct prefetch_item {
+    uint64_t ino;
+    int param;
+} prefetch_item;
+
+typedef struct prefetcher {
+    pthread_t *threads;
+    int nb_threads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    prefetch_item items[PREFETCH_QUEUE_SIZE];
+    int head;
+    int count;
+    char stop;
+    void (*load)(void *arg, const uint64_t ino, const int param);
+    void *arg;
+} prefetcher;
+
+/*
+Initialize a stopped prefetcher, pushes are ignored until it is started
+*/
+void prefetcher_init(prefetcher *p);
+
+/*
+Start nb_threads threads loading queued nodes through load(arg, ino, param)
+Return 0 on success, -1 otherwise
+*/
+int prefetcher_start(prefetcher *p, const int nb_threads, void (*load)(void *arg, const uint64_t ino, const int param), void *arg);
+
+/*
+Queue the node of inode ino with param
+*/
+void prefetcher_push(prefetcher *p, const uint64_t ino, const int param);
+
+/*
+Stop the threads and drop the nodes not loaded yet
+The prefetcher can be started again
+*/
+void prefetcher_stop(prefetcher *p);
+
+/*
+Stop the prefetcher if needed and release it
+*/
+void prefetcher_free(prefetcher *p);
+
+#endif
@@ -0,0 +1,334 @@
+/* For clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "snapshot.h"
+
+/*
+Count the folders, the files and the bytes of names the image of folder and its subtree needs
+*/
+static void snapshot_count(const c_folder *folder, uint32_t *nb_folders, uint32_t *nb_files, uint32_t *names_size)
+{
+    int i;
+
+    (*nb_folders)++;
+    *names_size += (folder->name != NULL ? strlen(folder->name) : 0) + 1;
+
+    if (folder->files_loaded) {
+        for (i=0; i<folder->nb_files; i++) {
+            if (folder->files[i]->id[0] == 'n') continue;
+            (*nb_files)++;
+            *names_size += strlen(folder->files[i]->name) + 1;
+        }
+    }
+
+    for (i=0; i<folder->nb_folders; i++) snapshot_count(folder->folders[i], nb_folders, nb_files, names_size);
+}
+
+typedef struct snapshot_cursor {
+    snapshot_folder *folders;
+    snapshot_file *files;
+    char *names;
+    uint32_t nb_folders;
+    uint32_t nb_files;
+    uint32_t names_size;
+} snapshot_cursor;
+
+static uint32_t snapshot_name(snapshot_cursor *c, const char *name)
+{
+    uint32_t off;
+    size_t len;
+
+    off = c->names_size;
+    len = name != NULL ? strlen(name) : 0;
+    memcpy(c->names + off, name != NULL ? name : "", len+1);
+    c->names_size += len+1;
+
+    return off;
+}
+
+static void snapshot_fill(snapshot_cursor *c, const c_folder *folder, const int32_t parent)
+{
+    snapshot_folder *f;
+    snapshot_file *file;
+    int32_t index;
+    int i;
+
+    index = c->nb_folders++;
+    f = &c->folders[index];
+    memcpy(f->id, folder->id, 32);
+    f->parent = parent;
+    f->name_off = snapshot_name(c, folder->name);
+    f->files_loaded = folder->files_loaded;
+    f->reserved = 0;
+
+    if (folder->files_loaded) {
+        for (i=0; i<folder->nb_files; i++) {
+            if (folder->files[i]->id[0] == 'n') continue;
+            file = &c->files[c->nb_files++];
+            memcpy(file->id, folder->files[i]->id, 32);
+            file->size = folder->files[i]->size;
+            file->folder = index;
+            file->name_off = snapshot_name(c, folder->files[i]->name);
+        }
+    }
+
+    for (i=0; i<folder->nb_folders; i++) snapshot_fill(c, folder->folders[i], index);
+}
+
+int snapshot_save(const c_folder *root, const char *path)
+{
+    snapshot_header *header;
+    snapshot_cursor c;
+    uint32_t nb_folders = 0, nb_files = 0, names_size = 0;
+    size_t total, path_len;
+    char *image, *tmp_path;
+    FILE *f;
+    int r = 0;
+
+    snapshot_count(root, &nb_folders, &nb_files, &names_size);
+    total = sizeof(snapshot_header) + nb_folders*sizeof(snapshot_folder) + nb_files*sizeof(snapshot_file) + names_size;
+
+    image = calloc(1, total);
+    if (image == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+    header = (snapshot_header*)image;
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->version = SNAPSHOT_VERSION;
+    header->nb_folders = nb_folders;
+    header->nb_files = nb_files;
+    header->names_size = names_size;
+
+    c.folders = (snapshot_folder*)(image + sizeof(snapshot_header));
+    c.files = (snapshot_file*)(c.folders + nb_folders);
+    c.names = (char*)(c.files + nb_files);
+    c.nb_folders = 0;
+    c.nb_files = 0;
+    c.names_size = 0;
+    snapshot_fill(&c, root, -1);
+
+    path_len = strlen(path);
+    tmp_path = malloc(path_len+5);
+    if (tmp_path == NULL) {
+        perror("malloc()");
+        free(image);
+        return -1;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path+path_len, ".tmp", 5);
+
+    f = fopen(tmp_path, "w");
+    if (f == NULL) {
+        perror("fopen()");
+        free(tmp_path);
+        free(image);
+        return -1;
+    }
+    if (fwrite(image, 1, total, f) != total) {
+        perror("fwrite()");
+        r = -1;
+    }
+    if (fclose(f) != 0) {
+        perror("fclose()");
+        r = -1;
+    }
+    if (r == 0 && rename(tmp_path, path) != 0) {
+        perror("rename()");
+        r = -1;
+    }
+    if (r == -1) unlink(tmp_path);
+
+    free(tmp_path);
+    free(image);
+
+    return r;
+}
+
+/*
+Return the name at off into the names of an image, NULL if it does not end within them
+*/
+static const char* snapshot_get_name(const char *names, const uint32_t names_size, const uint32_t off)
+{
+    if (off >= names_size || memchr(names + off, '\0', names_size - off) == NULL) return NULL;
+
+    return names + off;
+}
+
+static c_folder* snapshot_build(const char *image, const size_t total)
+{
+    const snapshot_header *header;
+    const snapshot_folder *folders;
+    const snapshot_file *files;
+    const char *names, *name;
+    c_folder **nodes, *root;
+    uint32_t i;
+    char ok = 1;
+
+    header = (const snapshot_header*)image;
+    if (total < sizeof(snapshot_header) || memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+        || header->version != SNAPSHOT_VERSION || header->nb_folders == 0) return NULL;
+    if (total != sizeof(snapshot_header) + (size_t)header->nb_folders*sizeof(snapshot_folder)
+        + (size_t)header->nb_files*sizeof(snapshot_file) + header->names_size) return NULL;
+
+    folders = (const snapshot_folder*)(image + sizeof(snapshot_header));
+    files = (const snapshot_file*)(folders + header->nb_folders);
+    names = (const char*)(files + header->nb_files);
+    if (folders[0].parent != -1) return NULL;
+
+    nodes = malloc(header->nb_folders * sizeof(c_folder*));
+    if (nodes == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    root = add_folder(NULL, folders[0].id, NULL);
+    if (root == NULL) {
+        free(nodes);
+        return NULL;
+    }
+    nodes[0] = root;
+
+    for (i=1; ok && i<header->nb_folders; i++) {
+        name = snapshot_get_name(names, header->names_size, folders[i].name_off);
+        ok = folders[i].parent >= 0 && (uint32_t)folders[i].parent < i && name != NULL;
+        if (ok) nodes[i] = add_folder(nodes[folders[i].parent], folders[i].id, name);
+        ok = ok && nodes[i] != NULL;
+    }
+    for (i=0; ok && i<header->nb_files; i++) {
+        name = snapshot_get_name(names, header->names_size, files[i].name_off);
+        ok = files[i].folder >= 0 && (uint32_t)files[i].folder < header->nb_folders && name != NULL;
+        ok = ok && add_file(nodes[files[i].folder], files[i].id, name, files[i].size) != NULL;
+    }
+    if (!ok) {
+        fputs("snapshot_load(): corrupted snapshot\n", stderr);
+        free(nodes);
+        free_scratch_root(root);
+        return NULL;
+    }
+
+    for (i=0; i<header->nb_folders; i++) {
+        if (folders[i].files_loaded) set_folder_loaded(nodes[i]);
+    }
+    free(nodes);
+
+    return root;
+}
+
+c_folder* snapshot_load(const char *path)
+{
+    struct stat st;
+    c_folder *root;
+    void *image;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        if (errno != ENOENT) perror("open()");
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1) {
+        perror("fstat()");
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED) {
+        perror("mmap()");
+        return NULL;
+    }
+
+    root = snapshot_build(image, st.st_size);
+    munmap(image, st.st_size);
+
+    return root;
+}
+
+static void* snapshot_worker_run(void *arg)
+{
+    snapshot_worker *w = arg;
+    struct timespec deadline;
+
+    if (w->first != NULL) w->first(w->arg);
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        if (w->interval <= 0) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += w->interval;
+        while (!w->stop && pthread_cond_timedwait(&w->cond, &w->lock, &deadline) != ETIMEDOUT);
+        if (w->stop) break;
+
+        pthread_mutex_unlock(&w->lock);
+        w->save(w->arg);
+        pthread_mutex_lock(&w->lock);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+void snapshot_worker_init(snapshot_worker *w)
+{
+    memset(w, 0, sizeof(snapshot_worker));
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+}
+
+int snapshot_worker_start(snapshot_worker *w, const int interval, void (*first)(void *arg), void (*save)(void *arg), void *arg)
+{
+    w->interval = interval;
+    w->first = first;
+    w->save = save;
+    w->arg = arg;
+    w->stop = 0;
+
+    if (pthread_create(&w->thread, NULL, snapshot_worker_run, w) != 0) {
+        fputs("pthread_create(): error\n", stderr);
+        return -1;
+    }
+    w->running = 1;
+
+    return 0;
+}
+
+char snapshot_worker_stopping(snapshot_worker *w)
+{
+    char stop;
+
+    pthread_mutex_lock(&w->lock);
+    stop = w->stop;
+    pthread_mutex_unlock(&w->lock);
+
+    return stop;
+}
+
+void snapshot_worker_stop(snapshot_worker *w)
+{
+    if (!w->running) return;
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+    w->running = 0;
+}
+
+void snapshot_worker_free(snapshot_worker *w)
+{
+    snapshot_worker_stop(w);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+}
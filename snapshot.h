@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "data_structures.h"
+
+#ifndef DGP_SNAPSHOT_H
+#define DGP_SNAPSHOT_H
+
+#define SNAPSHOT_NAME "snapshot"
+#define SNAPSHOT_MAGIC "DGPSNAP"
+#define SNAPSHOT_VERSION 1
+
+/*
+Binary image of a tree, mapped as is on load
+The header is followed by the folders in pre-order, so that a parent always comes before its children,
+then the files of the folders whose listing was loaded, then the names back to back, each ending with a null byte
+parent and folder are indexes into the folders, the root is the first folder and has a parent of -1
+The image is only meant to be read by the host that wrote it
+*/
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_folders;
+    uint32_t nb_files;
+    uint32_t names_size;
+} snapshot_header;
+
+typedef struct snapshot_folder {
+    char id[32];
+    int32_t parent;
+    uint32_t name_off;
+    uint32_t files_loaded;
+    uint32_t reserved;
+} snapshot_folder;
+
+typedef struct snapshot_file {
+    char id[32];
+    uint64_t size;
+    int32_t folder;
+    uint32_t name_off;
+} snapshot_file;
+
+/*
+Write the image of the tree of root to path, replacing it at once
+Files whose id starts with 'n' are not uploaded yet and left out
+The tree must not change meanwhile, holding the tree lock for reading is enough
+Return 0 on success, -1 otherwise
+*/
+int snapshot_save(const c_folder *root, const char *path);
+
+/*
+Build a new tree from the image at path
+Return its root, NULL if there is no valid image
+*/
+c_folder* snapshot_load(const char *path);
+
+/*
+Background thread running first(arg) once, then save(arg) every interval seconds until stopped
+*/
+typedef struct snapshot_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    char running;
+    char stop;
+    int interval;
+    void (*first)(void *arg);
+    void (*save)(void *arg);
+    void *arg;
+} snapshot_worker;
+
+/*
+Initialize a stopped worker
+*/
+void snapshot_worker_init(snapshot_worker *w);
+
+/*
+Start the thread, first may be NULL and an interval of 0 disables the periodic saves
+Return 0 on success, -1 otherwise
+*/
+int snapshot_worker_start(snapshot_worker *w, const int interval, void (*first)(void *arg), void (*save)(void *arg), void *arg);
+
+/*
+Tell whether the worker is being stopped, so that a long first() may return early
+*/
+char snapshot_worker_stopping(snapshot_worker *w);
+
+/*
+Stop the thread once first() or save() in progress returns
+The worker can be started again
+*/
+void snapshot_worker_stop(snapshot_worker *w);
+
+/*
+Stop the worker if needed and release it
+*/
+void snapshot_worker_free(snapshot_worker *w);
+
+#endif
@@ -0,0 +1,192 @@
+/* For clock_gettime() */
+#define _POSIX_C_SOURCE 200809L
+
+#include "writeback.h"
+
+static void due_in(struct timespec *due, const int seconds)
+{
+    clock_gettime(CLOCK_REALTIME, due);
+    due->tv_sec += seconds;
+}
+
+static char due_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec);
+}
+
+/*
+Return the item not being uploaded that is due first, NULL if there is none
+*/
+static writeback_item* writeback_next(const writeback *w)
+{
+    writeback_item *item, *next = NULL;
+
+    for (item=w->items; item!=NULL; item=item->next) {
+        if (!item->busy && (next == NULL || due_before(&item->due, &next->due))) next = item;
+    }
+
+    return next;
+}
+
+static void writeback_remove(writeback *w, const writeback_item *item)
+{
+    writeback_item **ptr;
+
+    for (ptr=&w->items; *ptr!=item; ptr=&(*ptr)->next);
+    *ptr = item->next;
+    w->count--;
+}
+
+static void* writeback_run(void *arg)
+{
+    writeback *w = arg;
+    writeback_item *item;
+    struct timespec now;
+    int r, backoff;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        item = writeback_next(w);
+        if (item == NULL) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+
+        //Pushes and new items wake the thread up, the earliest item is then looked for again
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (!due_before(&item->due, &now)) {
+            pthread_cond_timedwait(&w->cond, &w->lock, &item->due);
+            continue;
+        }
+
+        item->busy = 1;
+        pthread_mutex_unlock(&w->lock);
+
+        r = w->upload(w->arg, item->ino);
+
+        pthread_mutex_lock(&w->lock);
+        item->busy = 0;
+        if (item->again) item->again = 0;
+        else if (r == 1) due_in(&item->due, w->delay > 0 ? w->delay : 1);
+        else if (r == -1) {
+            item->failures++;
+            backoff = item->failures < 7 ? 1 << (item->failures-1) : WRITEBACK_MAX_BACKOFF;
+            if (backoff > WRITEBACK_MAX_BACKOFF) backoff = WRITEBACK_MAX_BACKOFF;
+            due_in(&item->due, (w->delay > 0 ? w->delay : 1) * backoff);
+        }
+        else {
+            writeback_remove(w, item);
+            free(item);
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+void writeback_init(writeback *w)
+{
+    memset(w, 0, sizeof(writeback));
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+}
+
+int writeback_start(writeback *w, const int delay, int (*upload)(void *arg, const uint64_t ino), void *arg)
+{
+    w->delay = delay;
+    w->upload = upload;
+    w->arg = arg;
+    w->stop = 0;
+
+    if (pthread_create(&w->thread, NULL, writeback_run, w) != 0) {
+        fputs("pthread_create(): error\n", stderr);
+        return -1;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->running = 1;
+    pthread_mutex_unlock(&w->lock);
+
+    return 0;
+}
+
+void writeback_push(writeback *w, const uint64_t ino)
+{
+    writeback_item *item;
+
+    pthread_mutex_lock(&w->lock);
+    if (!w->running) {
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+
+    for (item=w->items; item!=NULL && item->ino!=ino; item=item->next);
+    if (item == NULL) {
+        item = malloc(sizeof(writeback_item));
+        if (item == NULL) {
+            perror("malloc()");
+            pthread_mutex_unlock(&w->lock);
+            return;
+        }
+        item->ino = ino;
+        item->busy = 0;
+        item->next = w->items;
+        w->items = item;
+        w->count++;
+    }
+    item->again = item->busy;
+    item->failures = 0;
+    due_in(&item->due, w->delay);
+
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+int writeback_pending(writeback *w, uint64_t **inos)
+{
+    writeback_item *item;
+    int n;
+
+    pthread_mutex_lock(&w->lock);
+    *inos = malloc((w->count > 0 ? w->count : 1) * sizeof(uint64_t));
+    if (*inos == NULL) {
+        perror("malloc()");
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+    n = 0;
+    for (item=w->items; item!=NULL; item=item->next) (*inos)[n++] = item->ino;
+    pthread_mutex_unlock(&w->lock);
+
+    return n;
+}
+
+void writeback_stop(writeback *w)
+{
+    writeback_item *item, *next;
+
+    pthread_mutex_lock(&w->lock);
+    if (!w->running) {
+        pthread_mutex_unlock(&w->lock);
+        return;
+    }
+    w->stop = 1;
+    w->running = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+
+    pthread_join(w->thread, NULL);
+
+    for (item=w->items; item!=NULL; item=next) {
+        next = item->next;
+        free(item);
+    }
+    w->items = NULL;
+    w->count = 0;
+}
+
+void writeback_free(writeback *w)
+{
+    writeback_stop(w);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifndef DGP_WRITEBACK_H
+#define DGP_WRITEBACK_H
+
+//Most times the delay a failed upload waits before being retried
+#define WRITEBACK_MAX_BACKOFF 64
+
+/*
+Uploads of files left alone for delay seconds, run one at a time by a background thread
+Pushing a file already queued postpones its upload, so that successive saves are uploaded once
+A failed upload is retried, waiting twice as long after each failure, up to WRITEBACK_MAX_BACKOFF times the delay
+An item stays queued while it is uploaded (busy), again is set if it is pushed meanwhile so that it is uploaded once more
+*/
+typedef struct writeback_item {
+    uint64_t ino;
+    struct timespec due;
+    int failures;
+    char busy;
+    char again;
+    struct writeback_item *next;
+} writeback_item;
+
+typedef struct writeback {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    writeback_item *items;
+    int count;
+    char running;
+    char stop;
+    int delay;
+    int (*upload)(void *arg, const uint64_t ino);
+    void *arg;
+} writeback;
+
+/*
+Initialize a stopped queue, pushes are ignored until it is started
+*/
+void writeback_init(writeback *w);
+
+/*
+Start the thread uploading queued files through upload(arg, ino)
+It returns -1 for the upload to be retried, 1 for it to be postponed by the delay without counting as a failure
+Return 0 on success, -1 otherwise
+*/
+int writeback_start(writeback *w, const int delay, int (*upload)(void *arg, const uint64_t ino), void *arg);
+
+/*
+Queue the upload of the file of inode ino delay seconds from now, or postpone it if it is queued already
+*/
+void writeback_push(writeback *w, const uint64_t ino);
+
+/*
+Set inos to an allocated copy of the inodes queued, the one being uploaded included
+Return their number, -1 on error
+*/
+int writeback_pending(writeback *w, uint64_t **inos);
+
+/*
+Stop the thread once the upload in progress returns and drop the files not uploaded yet
+The queue can be started again
+*/
+void writeback_stop(writeback *w);
+
+/*
+Stop the queue if needed and release it
+*/
+void writeback_free(writeback *w);
+
+#endif